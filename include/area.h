@@ -26,5 +26,6 @@ typedef enum direction
 
 Area get_sub_area(Area area, Direction direction);
 int area_contains(Area area, int x, int y);
+int area_intersects(Area a, Area b);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+/**
+ * Arena of quadtree nodes. Nodes are allocated in large slabs by bumping a
+ * pointer, and a whole tree is released at once with its arena.
+ */
+
+#ifndef __ARENA
+#define __ARENA
+
+#include <stddef.h>
+
+/* Size and alignment of a slab, in bytes. */
+#define ARENA_SLAB_SIZE (1 << 18)
+
+struct node;
+struct slab;
+
+/**
+ * The slabs holding the nodes of a tree.
+ */
+typedef struct node_arena {
+    /* The slab being filled is the first one. */
+    struct slab *slabs;
+    /* Number of bytes used in the slab being filled. */
+    size_t used;
+    size_t nb_nodes;
+    /* The root of the tree owning the arena. */
+    struct node *root;
+} NodeArena;
+
+NodeArena *arena_create(void);
+struct node *arena_alloc(NodeArena *arena);
+void arena_merge(NodeArena *dest, NodeArena *src);
+void arena_release(NodeArena *arena);
+NodeArena *arena_owner(struct node *node);
+
+#endif
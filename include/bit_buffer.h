@@ -1,22 +1,47 @@
 /**
- * A Bit buffer, storing bits one by one in an array of char.
+ * A Bit buffer, storing bits in an array of char through a 64-bit
+ * accumulator, so up to 57 bits are written or read at once. A buffer opened
+ * from a file is a read-only view over its mapping, or a window over a stream
+ * when the file cannot be mapped.
  */ 
 
 #ifndef __BIT_BUFFER
 #define __BIT_BUFFER
 
+#include <stdio.h>
+#include <stdint.h>
 #include "../include/quadtree.h"
 
+/* Largest number of bits written or read at once. */
+#define BBUF_MAX_BITS 57
+
+/* Size of the window read at once from a stream which cannot be mapped. */
+#define BBUF_CHUNK 65536
+
 typedef struct {
     size_t size;
     size_t bit_pos;
     char *buffer;
+    /* Bytes stored in the buffer when writing, loaded from it when reading. */
+    size_t byte_pos;
+    /* Bits not stored yet, or not read yet, in the low bits. */
+    uint64_t accumulator;
+    int nb_bits;
+    /* The buffer is the mapping of the opened file. */
+    int mapped;
+    /* The stream read by windows, NULL when the whole file is in the buffer. */
+    FILE *stream;
+    /* Offset in the stream of the first byte of the buffer. */
+    size_t offset;
+    /* Bits were read past the end of the data. */
+    int past_end;
 } BitBuffer;
 
 void bbuf_init(BitBuffer *b_buffer, int size);
 void bbuf_clear(BitBuffer b_buffer);
 
 void bbuf_add(BitBuffer *b_buffer, int bit);
+void bbuf_add_bits(BitBuffer *b_buffer, uint64_t value, int nb_bits);
 void bbuf_add_char(BitBuffer *b_buffer, char type);
 void bbuf_add_color(BitBuffer *b_buffer, uint32_t color);
 
@@ -24,7 +49,11 @@ void bbuf_put(FILE *dest, BitBuffer *b_buffer);
 void print_bit(int octet);
 
 void bbuf_open(BitBuffer *b_buffer, FILE *src);
+void bbuf_seek(BitBuffer *b_buffer, size_t bit_pos);
+void bbuf_rewind(BitBuffer *b_buffer);
 int bbuf_read(BitBuffer *b_buffer);
+uint64_t bbuf_read_bits(BitBuffer *b_buffer, int nb_bits);
 uint32_t bbuf_read_color(BitBuffer *b_buffer);
+int bbuf_past_end(BitBuffer *b_buffer);
 
-#endif
\ No newline at end of file
+#endif
@@ -6,10 +6,61 @@
 #include "area.h"
 #include "color.h"
 
+/* Size of the square drawing area where images are displayed. */
 #define IMG_SIZE 512
 
-void convert_img_to_bitmap(MLV_Image *img, Color bitmap[IMG_SIZE][IMG_SIZE]);
-Color bitmap_average_color(Color bitmap[IMG_SIZE][IMG_SIZE], Area area);
-long error_value(Color bitmap[IMG_SIZE][IMG_SIZE], Area area);
+/**
+ * An image of any dimension, stored row by row in a heap-allocated array.
+ */
+typedef struct {
+    int width;
+    int height;
+    Color *pixels;
+} Bitmap;
 
-#endif
\ No newline at end of file
+/* Access the pixel of a bitmap at the specified coordinate. */
+#define BITMAP_PIXEL(bitmap, x, y) ((bitmap)->pixels[(size_t) (y) * (bitmap)->width + (x)])
+
+/**
+ * Per-channel sums and sums of squares over a set of pixels.
+ */
+typedef struct {
+    uint64_t sum[4];
+    uint64_t square[4];
+} ChannelSums;
+
+/* Largest number of pixels of an area given summed-area tables, larger
+areas being split like the quadtree. */
+#define REGION_TILE_PIXELS (1 << 16)
+
+/**
+ * Summed-area tables of an area of a bitmap. Entry (x, y) holds the channel
+ * sums of every pixel of the area above and to the left of (x, y), so the
+ * statistics of any area inside it are obtained from four lookups. The
+ * tables are loaded for one area at a time, reusing their memory.
+ */
+typedef struct {
+    Area area;
+    size_t capacity;
+    ChannelSums *table;
+} RegionStats;
+
+void bitmap_init(Bitmap *bitmap, int width, int height);
+void bitmap_clear(Bitmap bitmap);
+void convert_img_to_bitmap(MLV_Image *img, Bitmap *bitmap);
+Color bitmap_average_color(Bitmap *bitmap, Area area);
+long error_value(Bitmap *bitmap, Area area);
+
+void bitmap_area_sums(Bitmap *bitmap, Area area, ChannelSums *sums);
+
+void region_stats_init(RegionStats *stats);
+void region_stats_load(RegionStats *stats, Bitmap *bitmap, Area area);
+void region_stats_clear(RegionStats stats);
+void region_sums(RegionStats *stats, Area area, ChannelSums *sums);
+Color region_average_color(RegionStats *stats, Area area);
+long region_error_value(RegionStats *stats, Area area);
+
+Color sums_average_color(ChannelSums *sums, long nb_pixels);
+long sums_error_value(ChannelSums *sums, long nb_pixels);
+
+#endif
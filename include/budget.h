@@ -0,0 +1,27 @@
+/**
+ * Budgeted quadtree construction. The leaf with the largest error is split
+ * first, until a node count, file size or time limit is reached.
+ */
+
+#ifndef __BUDGET
+#define __BUDGET
+
+#include "quadtree.h"
+
+/**
+ * Limits of a budgeted construction. A limit set to 0 is ignored.
+ */
+typedef struct {
+    /* Maximum number of nodes in the tree. */
+    size_t max_nodes;
+    /* Maximum size of the tree saved to the destination file, in bytes. */
+    size_t max_bytes;
+    /* Destination file, whose format measures max_bytes (qtn or qtc). */
+    const char *dest;
+    /* Maximum processor time spent splitting leaves, in seconds. */
+    double max_seconds;
+} BuildBudget;
+
+Quadtree budget_create_quadtree(Bitmap *bitmap, BuildBudget budget);
+
+#endif
@@ -15,6 +15,9 @@ typedef enum
     ALPHA
 } ChannelType;
 
+/* Number of channels of a color. */
+#define NB_CHANNELS 4
+
 Channel red(Color Color);
 Channel green(Color Color);
 Channel blue(Color Color);
@@ -14,7 +14,8 @@ typedef enum {
     BOX
 } draw_style;
 
-void draw_quadtree_process(int x, int y, Quadtree root, draw_style style, int delay);
-void draw_quadtree_image(int x, int y, Quadtree tree, draw_style style);
+void draw_quadtree_process(int x, int y, Quadtree root, int width, int height, draw_style style, int delay);
+void draw_quadtree_image(int x, int y, Quadtree tree, int width, int height, draw_style style);
+void draw_fit_size(int width, int height, int size, int *fit_width, int *fit_height);
 
 #endif
\ No newline at end of file
@@ -2,23 +2,57 @@
 #define __ENCODE
 
 #include "../include/quadtree.h"
+#include "../include/linear_quadtree.h"
+#include "../include/bit_buffer.h"
+#include "../include/palette.h"
+
+/* Largest palette of the qtp files saved from their extension. */
+#define QTP_COLORS 256
 
 typedef enum {
     BIT,
     COLOR
 } color_format;
 
-void enc_save_to_qtn(Quadtree tree, const char* filename);
-void enc_save_to_qtc(Quadtree tree, const char* filename);
-Quadtree enc_load_qtn(const char* filename);
-Quadtree enc_load_qtc(const char* filename);
+/**
+ * A quadtree kept as in a qtp file: the nodes in pre-order, a bit for each
+ * one followed by the index of its palette color for the leaves.
+ */
+typedef struct {
+    int width;
+    int height;
+    Palette palette;
+    int index_bits;
+    BitBuffer nodes;
+} IndexedQuadtree;
+
+void enc_save_to_qtn(Quadtree tree, int width, int height, const char* filename);
+void enc_save_to_qtc(Quadtree tree, int width, int height, const char* filename);
+void enc_save_linear_to_qtn(LinearQuadtree *lqt, int width, int height, const char* filename);
+void enc_save_linear_to_qtc(LinearQuadtree *lqt, int width, int height, const char* filename);
+Quadtree enc_load_qtn(const char* filename, int *width, int *height);
+Quadtree enc_load_qtc(const char* filename, int *width, int *height);
+
+void enc_save_to_qte(Quadtree tree, int width, int height, const char* filename);
+Quadtree enc_load_qte(const char* filename, int *width, int *height);
+
+void enc_save_to_qtp(Quadtree tree, int width, int height, const char* filename, size_t max_colors);
+Quadtree enc_load_qtp(const char* filename, int *width, int *height);
+int enc_load_indexed(const char* filename, IndexedQuadtree *indexed);
+void enc_indexed_clear(IndexedQuadtree indexed);
+Quadtree enc_indexed_to_quadtree(IndexedQuadtree *indexed, int hash_consing);
+void enc_indexed_for_each_leaf(IndexedQuadtree *indexed, void (*visit)(Area area, Color color, void *data), void *data);
+size_t enc_indexed_memory(IndexedQuadtree *indexed);
 
-void enc_save_to_gmn(Quadtree, const char* filename);
-void enc_save_to_gmc(Quadtree, const char* filename);
-Quadtree enc_load_gmn(const char* filename);
-Quadtree enc_load_gmc(const char* filename);
+void enc_save_to_gmn(Quadtree, int width, int height, const char* filename);
+void enc_save_to_gmc(Quadtree, int width, int height, const char* filename);
+Quadtree enc_load_gmn(const char* filename, int *width, int *height);
+Quadtree enc_load_gmc(const char* filename, int *width, int *height);
 
-int enc_save(Quadtree tree, const char* filename);
-Quadtree enc_load(const char* filename);
+int enc_save(Quadtree tree, int width, int height, const char* filename);
+Quadtree enc_load(const char* filename, int *width, int *height);
+Quadtree enc_load_shared(const char* filename, int *width, int *height);
+size_t enc_size(Quadtree tree, int width, int height, const char* filename);
+size_t enc_nodes_size(size_t leaves, size_t internal_nodes, const char* filename);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+/**
+ * Headless image ingestion. Bitmaps are filled in bulk from raw pixel
+ * buffers or netpbm files, without MLV and without a display.
+ */
+
+#ifndef __INGEST
+#define __INGEST
+
+#include <stddef.h>
+#include <stdio.h>
+#include "bitmap.h"
+
+/* Layout of the samples of a raw pixel buffer, one byte per sample. */
+typedef enum {
+    PIXEL_GRAY,
+    PIXEL_GRAY_ALPHA,
+    PIXEL_RGB,
+    PIXEL_RGBA
+} pixel_format;
+
+/**
+ * A netpbm file opened to read areas of its raster, for images which do not
+ * fit in memory.
+ */
+typedef struct {
+    FILE *file;
+    int width;
+    int height;
+    int channels;
+    int maxval;
+    /* Offset of the first pixel in the file. */
+    long raster;
+} ImageStream;
+
+void ingest_from_buffer(Bitmap *bitmap, const unsigned char *pixels, int width, int height,
+    size_t stride, pixel_format format);
+
+int ingest_load_ppm(const char *filename, Bitmap *bitmap);
+int ingest_load_pam(const char *filename, Bitmap *bitmap);
+int ingest_load(const char *filename, Bitmap *bitmap);
+
+int ingest_open(const char *filename, ImageStream *stream);
+int ingest_read_area(ImageStream *stream, Area area, Bitmap *bitmap);
+void ingest_close(ImageStream *stream);
+
+#endif
@@ -0,0 +1,26 @@
+/**
+ * Vectorized kernels reading rows of packed pixels, used to measure the
+ * channel sums of areas and to build summed-area tables.
+ */
+
+#ifndef __KERNELS
+#define __KERNELS
+
+#include "bitmap.h"
+
+/* Implementations of the kernels, selected at runtime. */
+typedef enum {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2
+} kernel_set;
+
+void kernel_row_sums(const Color *row, int width, ChannelSums *sums);
+void kernel_row_prefix(const Color *row, int width, const ChannelSums *above, ChannelSums *cells);
+
+int kernel_supported(kernel_set kernel);
+int kernel_use(kernel_set kernel);
+kernel_set kernel_current(void);
+const char *kernel_name(kernel_set kernel);
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * Linear quadtree. Only the leaves are stored, in a contiguous array sorted
+ * by Morton code, without any pointer.
+ */
+
+#ifndef __LINEAR_QUADTREE
+#define __LINEAR_QUADTREE
+
+#include <stdint.h>
+#include "quadtree.h"
+
+/* Maximum depth of a leaf, two bits of the code per level. */
+#define LQT_MAX_DEPTH 32
+
+/**
+ * A leaf of a linear quadtree. The code holds the path from the root, two
+ * bits per level starting from the most significant bits: the high bit is
+ * set for southern sub-areas and the low bit for eastern ones, so for square
+ * power of 2 images the code interleaves the bits of y and x (Z-order).
+ */
+typedef struct {
+    uint64_t code;
+    uint8_t depth;
+    Color color;
+} LinearLeaf;
+
+/**
+ * The leaves of a quadtree sorted by code.
+ */
+typedef struct {
+    size_t size;
+    size_t capacity;
+    LinearLeaf *leaves;
+} LinearQuadtree;
+
+void lqt_init(LinearQuadtree *lqt);
+void lqt_clear(LinearQuadtree lqt);
+
+void lqt_from_quadtree(LinearQuadtree *lqt, Quadtree tree);
+Quadtree lqt_to_quadtree(LinearQuadtree *lqt);
+
+void lqt_for_each_leaf(LinearQuadtree *lqt, int width, int height,
+    void (*visit)(Area area, Color color, void *data), void *data);
+void lqt_preorder(LinearQuadtree *lqt, void (*visit)(int is_leaf, Color color, void *data), void *data);
+long lqt_find(LinearQuadtree *lqt, int width, int height, int x, int y);
+
+#endif
@@ -6,9 +6,45 @@ Quadtree minimization.
 #define COMP
 
 #include "../include/quadtree.h"
+#include "../include/node_map.h"
+#include "../include/tree_table.h"
+#include "../include/subtree_index.h"
 
 #define DISTANCE_RATE 4.8
 
+/**
+ * Classes of structurally identical subtrees of a quadtree. Each class is an
+ * entry of the table holding one of its nodes, and the classes of the
+ * children of a node come before its own.
+ */
+typedef struct {
+    /* Class of each node. */
+    NodeMap classes;
+    TreeTable table;
+    /* The colors of the internal nodes are ignored. */
+    int leaves_only;
+} SubtreeClasses;
+
+/**
+ * State of a lossy minimization, kept to minimize the later changes of the
+ * quadtree against the subtrees already indexed. The indexed nodes must not
+ * be modified, so the changes are made on copies.
+ */
+typedef struct {
+    SubtreeIndex index;
+    /* Nodes already minimized and indexed. */
+    NodeMap visited;
+} Minimizer;
+
 void minimize_loss(Quadtree tree, double distance);
+void minimizer_init(Minimizer *minimizer, Quadtree tree, double distance);
+void minimizer_update(Minimizer *minimizer, Quadtree tree, Bitmap *bitmap, Area area);
+void minimizer_clear(Minimizer minimizer);
+void minimize_lossless(Quadtree tree);
+void minimize_lossless_parallel(Quadtree tree, int nb_threads);
+
+void minimize_classify(Quadtree tree, SubtreeClasses *classes);
+void minimize_classify_leaves(Quadtree tree, SubtreeClasses *classes);
+void minimize_classes_clear(SubtreeClasses classes);
 
 #endif
\ No newline at end of file
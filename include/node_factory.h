@@ -0,0 +1,27 @@
+/**
+ * Factory of quadtree nodes shared by the builders and the loaders. With
+ * hash-consing, a node identical to one already made is returned instead of
+ * being allocated, so identical subtrees are never built twice.
+ */
+
+#ifndef __NODE_FACTORY
+#define __NODE_FACTORY
+
+#include "quadtree.h"
+#include "tree_table.h"
+
+/**
+ * Nodes allocated in an arena, children first. With hash-consing, the
+ * nodes made are kept in a table keyed by their color and children.
+ */
+typedef struct {
+    NodeArena *arena;
+    int hash_consing;
+    TreeTable nodes;
+} NodeFactory;
+
+void nfactory_init(NodeFactory *factory, NodeArena *arena, int hash_consing);
+void nfactory_clear(NodeFactory factory);
+Quadtree nfactory_make(NodeFactory *factory, Color color, Quadtree children[QT_MAX_NODE]);
+
+#endif
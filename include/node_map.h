@@ -0,0 +1,27 @@
+/**
+ * Map from quadtree nodes to numbers, owned by a single traversal. Used to
+ * mark visited nodes of a minimized quadtree without touching the nodes.
+ */
+
+#ifndef __NODE_MAP
+#define __NODE_MAP
+
+#include "quadtree.h"
+
+/**
+ * Open addressing hash table keyed by node address. Empty slots have a NULL
+ * key.
+ */
+typedef struct node_map {
+    size_t size;
+    size_t capacity;
+    Quadtree *keys;
+    size_t *values;
+} NodeMap;
+
+void nmap_init(NodeMap *map);
+void nmap_clear(NodeMap map);
+int nmap_put(NodeMap *map, Quadtree node, size_t value);
+int nmap_get(NodeMap *map, Quadtree node, size_t *value);
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * Palette of the leaf colors of a quadtree. The palette holds the distinct
+ * colors of the leaves when there are few enough of them, or colors
+ * quantized by median cut otherwise.
+ */
+
+#ifndef __PALETTE
+#define __PALETTE
+
+#include <stdint.h>
+
+#include "quadtree.h"
+
+/**
+ * Colors referenced by their index.
+ */
+typedef struct {
+    size_t size;
+    Color *colors;
+} Palette;
+
+/**
+ * The distinct leaf colors of a tree, sorted, with the index of the palette
+ * color standing for each one.
+ */
+typedef struct {
+    size_t size;
+    Color *colors;
+    uint32_t *indexes;
+} PaletteMap;
+
+void palette_build(Palette *palette, PaletteMap *map, Quadtree tree, int width, int height, size_t max_colors);
+void palette_clear(Palette palette);
+void palette_map_clear(PaletteMap map);
+
+uint32_t palette_map_index(PaletteMap *map, Color color);
+int palette_index_bits(size_t size);
+
+#endif
@@ -5,9 +5,12 @@
 #include "area.h"
 #include "color.h"
 #include "bitmap.h"
+#include "arena.h"
 
 #define QT_MAX_NODE 4
 
+struct node_map;
+
 /**
  * A structure to represent quadtree.
  */
@@ -16,26 +19,49 @@ typedef struct node
     struct node *nodes[QT_MAX_NODE];
     Color color;
 
-    /* Identification number for DAG encoding. */
-    size_t id;
+    /* Aggregates of the subtree, valid when cached is set. Nodes shared by
+    several branches of a minimized quadtree are counted at each use. */
+    uint32_t nb_nodes;
+    uint32_t nb_leaves;
+    uint16_t height;
+
+    /* Number of distinct nodes of the subtree, 0 when unknown. */
+    uint32_t nb_distinct;
+
+    char cached:1;
+
+    /* The subtree may hold nodes shared by several branches. */
+    char shared:1;
+
+    /* Allocated in a NodeArena, released with the whole tree. */
+    char in_arena:1;
 
-    /* Allow for DAG iteration. */
-    char visited:1;
-    
 } * Quadtree, Node;
 
 Quadtree qt_create_node(Color value);
-Quadtree qt_create_quadtree(MLV_Image *img);
+Quadtree qt_create_arena_node(NodeArena *arena, Color value);
+Quadtree qt_create_quadtree(Bitmap *bitmap);
+Quadtree qt_create_quadtree_shared(Bitmap *bitmap);
+Quadtree qt_create_quadtree_bottom_up(Bitmap *bitmap, long tolerance);
+Quadtree qt_create_quadtree_parallel(Bitmap *bitmap, int nb_threads);
+Quadtree qt_bottom_up_subtree(Bitmap *bitmap, long tolerance, ChannelSums *sums, NodeArena *arena);
+Quadtree qt_merge_subtrees(Quadtree children[QT_MAX_NODE], ChannelSums children_sums[QT_MAX_NODE],
+    Area area, long tolerance, ChannelSums *sums, NodeArena *arena);
+void qt_update_area(Quadtree tree, Bitmap *bitmap, Area area, int copy_nodes);
 void qt_free(Quadtree quadtree);
 void qt_free_minimized(Quadtree tree);
 int qt_height(Quadtree quadtree);
 double qt_distance(Quadtree a, Quadtree b);
+double qt_distance_bounded(Quadtree a, Quadtree b, double bound);
+int qt_equals(Quadtree a, Quadtree b);
 int qt_is_leaf(Quadtree tree);
 int qt_count_node(Quadtree tree);
 int qt_count_leaf(Quadtree tree);
-void qt_reset_visited_nodes(Quadtree tree);
 void qt_get_infos(Quadtree tree, size_t *leaves, size_t *internal_nodes);
-void qt_set_id(Quadtree tree);
+void qt_get_tree_infos(Quadtree tree, size_t *leaves, size_t *internal_nodes);
+void qt_cache_node(Quadtree node);
+void qt_cache_aggregates(Quadtree tree);
+void qt_set_id(Quadtree tree, struct node_map *ids);
 void qt_reset_color(Quadtree tree);
 
 #endif
\ No newline at end of file
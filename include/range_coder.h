@@ -0,0 +1,56 @@
+/**
+ * Adaptive binary range coder. Each bit is coded with the probability of a
+ * context, which is updated after it, so the bits which are easy to predict
+ * take a fraction of a bit. The bytes are written to and read from a bit
+ * buffer.
+ */
+
+#ifndef __RANGE_CODER
+#define __RANGE_CODER
+
+#include <stdint.h>
+
+#include "bit_buffer.h"
+
+/* Number of bits of the probabilities. */
+#define RC_PROB_BITS 11
+
+/* Probability of a context which has not coded any bit yet. */
+#define RC_PROB_INIT (1 << (RC_PROB_BITS - 1))
+
+/* Number of contexts of a byte, one for each node of its binary tree. */
+#define RC_BYTE_PROBS 256
+
+/**
+ * Probability of a zero bit in a context, out of 1 << RC_PROB_BITS.
+ */
+typedef uint16_t RcProb;
+
+typedef struct {
+    BitBuffer *b_buffer;
+    uint64_t low;
+    uint32_t range;
+    /* The last byte kept back, while a carry may still change it, followed
+    by cache_size - 1 bytes 0xFF. */
+    uint8_t cache;
+    size_t cache_size;
+} RangeEncoder;
+
+typedef struct {
+    BitBuffer *b_buffer;
+    uint32_t range;
+    uint32_t code;
+} RangeDecoder;
+
+void rcoder_init_probs(RcProb *probs, size_t nb_probs);
+
+void rcoder_encoder_init(RangeEncoder *encoder, BitBuffer *b_buffer);
+void rcoder_encode(RangeEncoder *encoder, RcProb *prob, int bit);
+void rcoder_encode_byte(RangeEncoder *encoder, RcProb probs[RC_BYTE_PROBS], int byte);
+void rcoder_flush(RangeEncoder *encoder);
+
+void rcoder_decoder_init(RangeDecoder *decoder, BitBuffer *b_buffer);
+int rcoder_decode(RangeDecoder *decoder, RcProb *prob);
+int rcoder_decode_byte(RangeDecoder *decoder, RcProb probs[RC_BYTE_PROBS]);
+
+#endif
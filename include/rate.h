@@ -0,0 +1,40 @@
+/**
+ * Minimization driven by a target. The distance of the minimization is
+ * searched until the file size, node count or quality of the tree meets it.
+ */
+
+#ifndef __RATE
+#define __RATE
+
+#include "quadtree.h"
+
+/**
+ * Targets of a minimization. A target set to 0 is ignored. The smallest
+ * distance within the size targets is searched, or the largest one within
+ * the quality target when there is no size target.
+ */
+typedef struct {
+    /* Maximum size of the saved file, in bytes. */
+    size_t max_bytes;
+    /* Maximum number of distinct nodes in the tree. */
+    size_t max_nodes;
+    /* Minimum peak signal-to-noise ratio against the bitmap, in decibels. */
+    double min_psnr;
+} RateTarget;
+
+/**
+ * Measures of a minimized tree.
+ */
+typedef struct {
+    double distance;
+    size_t nb_bytes;
+    size_t nb_nodes;
+    double psnr;
+    /* Every target is met. */
+    int met;
+} RateResult;
+
+Quadtree rate_minimize(Bitmap *bitmap, RateTarget target, const char *filename, RateResult *result);
+double rate_psnr(Quadtree tree, Bitmap *bitmap);
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * Index of subtrees by mean color, used to find the subtrees within a
+ * distance of another one while minimizing with loss.
+ */
+
+#ifndef __SUBTREE_INDEX
+#define __SUBTREE_INDEX
+
+#include <stdint.h>
+#include "quadtree.h"
+#include "node_map.h"
+#include "tree_table.h"
+
+/* Number of squares of a signature, a 4x4 grid over the area of a subtree. */
+#define SIGNATURE_SQUARES (QT_MAX_NODE * QT_MAX_NODE)
+
+/**
+ * Summary of the colors of a subtree. The squares are ordered by quadrant,
+ * then by quadrant of the quadrant, and rounded to bytes.
+ */
+typedef struct {
+    float mean[NB_CHANNELS];
+    uint8_t squares[SIGNATURE_SQUARES][NB_CHANNELS];
+} SubtreeSignature;
+
+/**
+ * Grid of cells over the mean colors of the subtrees of each height. The
+ * cells are as wide as the distance, and a query lists the cells of its
+ * neighbourhood closer than the distance. The signatures are computed once
+ * per node.
+ */
+typedef struct {
+    double distance;
+    double cell_size;
+    /* Subtrees added, keyed by cell. */
+    TreeTable cells;
+    /* Signature of each node, as an index in the signatures. */
+    NodeMap signature_ids;
+    size_t nb_signatures;
+    size_t signatures_capacity;
+    SubtreeSignature *signatures;
+    /* Signature of each entry of the cells. */
+    size_t *entry_signatures;
+} SubtreeIndex;
+
+void sindex_init(SubtreeIndex *index, size_t expected_trees, double distance);
+void sindex_clear(SubtreeIndex index);
+void sindex_add(SubtreeIndex *index, Quadtree tree);
+Quadtree sindex_find(SubtreeIndex *index, Quadtree tree);
+
+#endif
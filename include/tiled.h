@@ -0,0 +1,17 @@
+/**
+ * Out-of-core quadtree construction. The image is read from its file tile
+ * by tile, so only one tile is held in memory.
+ */
+
+#ifndef __TILED
+#define __TILED
+
+#include "quadtree.h"
+
+/* Default side of the largest tile, in pixels. */
+#define TILED_DEFAULT_TILE 1024
+
+Quadtree tiled_create_quadtree(const char *filename, int tile_size, long tolerance,
+    int *width, int *height);
+
+#endif
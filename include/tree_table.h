@@ -0,0 +1,51 @@
+/**
+ * Hash table of quadtrees grouped by key, used to find similar or identical
+ * subtrees while minimizing. Trees of a key are chained in a single entry array.
+ */
+
+#ifndef __TREE_TABLE
+#define __TREE_TABLE
+
+#include <stdint.h>
+#include "quadtree.h"
+
+/**
+ * A key of the table with the last entry added for it, -1 when the slot is
+ * empty.
+ */
+typedef struct {
+    uint32_t key;
+    long head;
+} TreeSlot;
+
+/**
+ * A tree of the table with the previous entry of the same key, -1 for the
+ * first one.
+ */
+typedef struct {
+    Quadtree tree;
+    long next;
+} TreeEntry;
+
+/**
+ * Open addressing table of keys, each one chaining its trees from the most
+ * recent. Both arrays grow as needed.
+ */
+typedef struct {
+    size_t nb_keys;
+    size_t nb_slots;
+    /* Number of bits of a slot index, nb_slots being 2 to this power. */
+    int slot_bits;
+    TreeSlot *slots;
+    size_t nb_entries;
+    size_t entries_capacity;
+    TreeEntry *entries;
+} TreeTable;
+
+void ttable_init(TreeTable *table, size_t expected_trees);
+void ttable_clear(TreeTable table);
+void ttable_add(TreeTable *table, uint32_t key, Quadtree tree);
+long ttable_first(TreeTable *table, uint32_t key);
+long ttable_find(TreeTable *table, uint32_t key, int (*match)(Quadtree candidate, void *data), void *data);
+
+#endif
@@ -6,6 +6,9 @@ Image visualisation area's structure.
 
 /**
  * Return the sub-area from the specified area at the given direction.
+ * Odd dimensions are split unevenly, the eastern and southern sub-areas
+ * receiving the extra column or row, so the four sub-areas always cover
+ * the area. A sub-area can be empty when the area is one pixel wide or high.
  * 
  * \param area the area to divide.
  * \param direction the direction of the sub-area to return.
@@ -13,10 +16,13 @@ Image visualisation area's structure.
  */ 
 Area get_sub_area(Area area, Direction direction)
 {
-    int x = area.x + (direction == NORTH_EAST || direction == SOUTH_EAST) * area.width / 2;
-    int y = area.y + (direction == SOUTH_WEST || direction == SOUTH_EAST) * area.height / 2;
-    int width = area.width / 2;
-    int height = area.height / 2;
+    int east = direction == NORTH_EAST || direction == SOUTH_EAST;
+    int south = direction == SOUTH_WEST || direction == SOUTH_EAST;
+
+    int x = area.x + east * (area.width / 2);
+    int y = area.y + south * (area.height / 2);
+    int width = east ? area.width - area.width / 2 : area.width / 2;
+    int height = south ? area.height - area.height / 2 : area.height / 2;
 
     return (Area){x, y, width, height};
 }
@@ -34,3 +40,15 @@ int area_contains(Area area, int x, int y) {
         y < area.y || y > area.width + area.y
     );
 }
+
+/**
+ * Return 1 if two areas share at least one pixel. An empty area shares none.
+ * \param a the first area.
+ * \param b the second area.
+ * \return 1 if the areas intersect.
+ */
+int area_intersects(Area a, Area b) {
+    return a.width > 0 && a.height > 0 && b.width > 0 && b.height > 0 &&
+        a.x < b.x + b.width && b.x < a.x + a.width &&
+        a.y < b.y + b.height && b.y < a.y + a.height;
+}
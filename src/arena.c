@@ -0,0 +1,147 @@
+/*
+Arena of quadtree nodes. Slabs are aligned on their size, so the arena of a
+node is found from its address through the header of its slab.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../include/arena.h"
+#include "../include/quadtree.h"
+
+/**
+ * The header opening each slab, followed by the nodes.
+ */
+typedef struct slab {
+    NodeArena *arena;
+    struct slab *next;
+} Slab;
+
+/* Offset of the first node of a slab, keeping the nodes aligned. */
+#define SLAB_HEADER ((sizeof(Slab) + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *))
+
+static Slab *create_slab(NodeArena *arena);
+
+/**
+ * Create an empty arena. It must be released using arena_release.
+ * \return the allocated arena.
+ */
+NodeArena *arena_create(void)
+{
+    NodeArena *arena = malloc(sizeof(NodeArena));
+    if (arena == NULL)
+    {
+        printf("Error malloc NodeArena\n");
+        exit(EXIT_FAILURE);
+    }
+
+    arena->slabs = NULL;
+    arena->used = ARENA_SLAB_SIZE;
+    arena->nb_nodes = 0;
+    arena->root = NULL;
+
+    return arena;
+}
+
+/**
+ * Allocate an uninitialized node in an arena. The node cannot be freed on its
+ * own, it lives until the arena is released.
+ * \param arena the arena in which to allocate the node.
+ * \return the allocated node.
+ */
+Node *arena_alloc(NodeArena *arena)
+{
+    if (arena->used + sizeof(Node) > ARENA_SLAB_SIZE)
+    {
+        Slab *slab = create_slab(arena);
+        slab->next = arena->slabs;
+        arena->slabs = slab;
+        arena->used = SLAB_HEADER;
+    }
+
+    Node *node = (Node *) ((char *) arena->slabs + arena->used);
+    arena->used += sizeof(Node);
+    arena->nb_nodes++;
+
+    return node;
+}
+
+Slab *create_slab(NodeArena *arena)
+{
+    void *memory;
+    if (posix_memalign(&memory, ARENA_SLAB_SIZE, ARENA_SLAB_SIZE) != 0)
+    {
+        printf("Error malloc Slab\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Slab *slab = memory;
+    slab->arena = arena;
+    slab->next = NULL;
+    return slab;
+}
+
+/**
+ * Move the nodes of an arena into another one, then release the emptied
+ * arena. The slab being filled in the destination stays the same.
+ * \param dest the arena receiving the nodes.
+ * \param src the arena to be merged.
+ */
+void arena_merge(NodeArena *dest, NodeArena *src)
+{
+    Slab *slab, *last = NULL;
+
+    for (slab = src->slabs; slab != NULL; slab = slab->next)
+    {
+        slab->arena = dest;
+        last = slab;
+    }
+
+    if (last != NULL)
+    {
+        if (dest->slabs == NULL)
+        {
+            dest->slabs = src->slabs;
+            dest->used = src->used;
+        }
+        else
+        {
+            last->next = dest->slabs->next;
+            dest->slabs->next = src->slabs;
+        }
+    }
+    dest->nb_nodes += src->nb_nodes;
+
+    free(src);
+}
+
+/**
+ * Release an arena with every node allocated in it.
+ * \param arena the arena to be released.
+ */
+void arena_release(NodeArena *arena)
+{
+    Slab *slab = arena->slabs;
+
+    while (slab != NULL)
+    {
+        Slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(arena);
+}
+
+/**
+ * Return the arena in which a node was allocated.
+ * \param node a node allocated with arena_alloc.
+ * \return the arena of the node.
+ */
+NodeArena *arena_owner(Node *node)
+{
+    Slab *slab = (Slab *) ((uintptr_t) node & ~((uintptr_t) ARENA_SLAB_SIZE - 1));
+    return slab->arena;
+}
@@ -1,5 +1,28 @@
+/*
+Bit buffer. The bits go through a 64-bit accumulator, most significant bit
+first: whole bytes are moved between the accumulator and the array, and the
+file is written with a single call. A regular file is read through a
+read-only mapping, so the decoder reads the pages of the file without copying
+them. Pipes and other files which cannot be mapped are read by windows of
+BBUF_CHUNK bytes.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
 #include "../include/bit_buffer.h"
 
+/* Return the mask of the lowest bits of a value. */
+#define LOW_BITS(nb_bits) (((uint64_t) 1 << (nb_bits)) - 1)
+
+static void reserve(BitBuffer *b_buffer);
+static void fill(BitBuffer *b_buffer);
+static int map_file(BitBuffer *b_buffer, FILE *src);
+static int read_window(BitBuffer *b_buffer);
 
 /**
  * Initialize the specified bit buffer with a given size.
@@ -7,15 +30,20 @@
  * \param size the size of the bit buffer.
  */
 void bbuf_init(BitBuffer *b_buffer, int size) {
-    b_buffer->size = size;
+    b_buffer->size = size > (int) sizeof(uint64_t) ? size : sizeof(uint64_t);
     b_buffer->buffer = malloc(b_buffer->size);
-    b_buffer->bit_pos = 0;
-
-    size_t i;
-    for (i = 0; i < b_buffer->size; i++)
-    {
-        b_buffer->buffer[i] = 0;
+    if(b_buffer->buffer == NULL) {
+        printf("Error malloc BitBuffer\n");
+        exit(EXIT_FAILURE);
     }
+    b_buffer->bit_pos = 0;
+    b_buffer->byte_pos = 0;
+    b_buffer->accumulator = 0;
+    b_buffer->nb_bits = 0;
+    b_buffer->mapped = 0;
+    b_buffer->stream = NULL;
+    b_buffer->offset = 0;
+    b_buffer->past_end = 0;
 }
 
 /**
@@ -24,16 +52,41 @@ void bbuf_init(BitBuffer *b_buffer, int size) {
  * \param bit the bit to add.
  */
 void bbuf_add(BitBuffer *b_buffer, int bit) {
-    if(b_buffer->bit_pos / 8 >= b_buffer->size) {
-        b_buffer->size *= 1.5;
-        b_buffer->buffer = realloc(b_buffer->buffer, b_buffer->size);
+    bbuf_add_bits(b_buffer, bit ? 1 : 0, 1);
+}
+
+/**
+ * Add the lowest bits of a value to the specified bit buffer, the most
+ * significant one first.
+ * \param b_buffer the bit buffer to be added.
+ * \param value the value whose bits are added.
+ * \param nb_bits the number of bits to add, at most BBUF_MAX_BITS.
+ */
+void bbuf_add_bits(BitBuffer *b_buffer, uint64_t value, int nb_bits) {
+    reserve(b_buffer);
+
+    /* At most 7 bits are left in the accumulator, so the value fits. */
+    b_buffer->accumulator = b_buffer->accumulator << nb_bits | (value & LOW_BITS(nb_bits));
+    b_buffer->nb_bits += nb_bits;
+    b_buffer->bit_pos += nb_bits;
+
+    while(b_buffer->nb_bits >= 8) {
+        b_buffer->nb_bits -= 8;
+        b_buffer->buffer[b_buffer->byte_pos++] = b_buffer->accumulator >> b_buffer->nb_bits;
     }
+}
 
-    int byte = b_buffer->bit_pos / 8;
-    int bit_pos = b_buffer->bit_pos % 8;
+/* Make room for the bytes of a full accumulator. The new bytes are written
+whole, so they need no clearing. */
+void reserve(BitBuffer *b_buffer) {
+    if(b_buffer->byte_pos + sizeof(uint64_t) <= b_buffer->size) return;
 
-    b_buffer->buffer[byte] |= bit << (7 - (bit_pos));
-    b_buffer->bit_pos++;
+    b_buffer->size *= 2;
+    b_buffer->buffer = realloc(b_buffer->buffer, b_buffer->size);
+    if(b_buffer->buffer == NULL) {
+        printf("Error malloc BitBuffer\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
 /**
@@ -41,7 +94,10 @@ void bbuf_add(BitBuffer *b_buffer, int bit) {
  * \param b_buffer the bit buffer to be cleared.
  */
 void bbuf_clear(BitBuffer b_buffer) {
-    free(b_buffer.buffer);
+    if(b_buffer.mapped)
+        munmap(b_buffer.buffer, b_buffer.size);
+    else
+        free(b_buffer.buffer);
 }
 
 void print_bit(int octet) {
@@ -59,10 +115,7 @@ void print_bit(int octet) {
  * \param color the color to add.
  */
 void bbuf_add_color(BitBuffer *b_buffer, uint32_t color) {
-    bbuf_add_char(b_buffer, red(color));
-    bbuf_add_char(b_buffer, green(color));
-    bbuf_add_char(b_buffer, blue(color));
-    bbuf_add_char(b_buffer, alpha(color));
+    bbuf_add_bits(b_buffer, color, 32);
 }
 
 /**
@@ -71,51 +124,121 @@ void bbuf_add_color(BitBuffer *b_buffer, uint32_t color) {
  * \param char the character to add.
  */
 void bbuf_add_char(BitBuffer *b_buffer, char c) {
-    int i;
-    for (i = 8 * sizeof(c) - 1; i >= 0; i--)
-    {
-        bbuf_add(b_buffer, c & 1 << i ? 1 : 0);
-    }
+    bbuf_add_bits(b_buffer, (unsigned char) c, 8);
 }
 
 /**
- *  Put the specified buffer to the destination file.
+ *  Put the specified buffer to the destination file. The last byte is
+ * completed with zeros.
  * \param dest the destination file.
  * \param b_buffer the bit buffer to put.
  */
 void bbuf_put(FILE *dest, BitBuffer *b_buffer) {
-    while(b_buffer->bit_pos % 8 != 0) {
-        bbuf_add(b_buffer, 0);
-    }
+    if(b_buffer->nb_bits > 0)
+        bbuf_add_bits(b_buffer, 0, 8 - b_buffer->nb_bits);
 
-    size_t i;
-    for (i = 0; i < b_buffer->bit_pos / 8; i++)
-    {
-        fprintf(dest, "%c", b_buffer->buffer[i]);
-    }
+    fwrite(b_buffer->buffer, 1, b_buffer->byte_pos, dest);
 }
 
 /**
- *  Read and add it to the specified bit buffer. 
- * \param b_buffer the bit to be added.
+ * Open the specified file for reading. A regular file is mapped and the buffer
+ * is a read-only view over it, other files are read by windows from the
+ * stream, which must stay open until the buffer is cleared.
+ * \param b_buffer the bit buffer to be opened.
  * \param src the source file from which to read.
  */
 void bbuf_open(BitBuffer *b_buffer, FILE *src) {
-    char c;
-    size_t size, i;
+    b_buffer->accumulator = 0;
+    b_buffer->nb_bits = 0;
+    b_buffer->bit_pos = 0;
+    b_buffer->offset = 0;
+    b_buffer->byte_pos = 0;
+    b_buffer->past_end = 0;
+    b_buffer->stream = NULL;
+    b_buffer->mapped = map_file(b_buffer, src);
+    if(b_buffer->mapped) return;
 
-    fseek(src, 0L, SEEK_END);
-    size = ftell(src);
-    rewind(src);
+    b_buffer->buffer = malloc(BBUF_CHUNK);
+    if(b_buffer->buffer == NULL) {
+        printf("Error malloc BitBuffer\n");
+        exit(EXIT_FAILURE);
+    }
+    b_buffer->stream = src;
+    b_buffer->size = 0;
+    read_window(b_buffer);
+}
 
-    b_buffer->buffer = malloc(size);
-    b_buffer->size = size;
-    b_buffer->bit_pos = 0;
-    for (i = 0; i < size; i++)
-    {
-        c = fgetc(src);
-        b_buffer->buffer[i] = c;
+/* Map a regular file, returning 0 if it cannot be mapped. The mapping starts
+at the beginning of the file whatever the position of the stream. */
+int map_file(BitBuffer *b_buffer, FILE *src) {
+    struct stat status;
+    void *mapping;
+
+    if(fstat(fileno(src), &status) != 0 || !S_ISREG(status.st_mode) || status.st_size <= 0)
+        return 0;
+
+    mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileno(src), 0);
+    if(mapping == MAP_FAILED) return 0;
+
+    posix_madvise(mapping, status.st_size, POSIX_MADV_SEQUENTIAL);
+    b_buffer->buffer = mapping;
+    b_buffer->size = status.st_size;
+    return 1;
+}
+
+/* Read the next window of the stream, returning 0 at its end. */
+int read_window(BitBuffer *b_buffer) {
+    b_buffer->offset += b_buffer->size;
+    b_buffer->byte_pos = 0;
+    b_buffer->size = fread(b_buffer->buffer, 1, BBUF_CHUNK, b_buffer->stream);
+    return b_buffer->size > 0;
+}
+
+/**
+ * Move the reading position of the specified bit buffer. A stream is only
+ * moved out of its window when it can seek.
+ * \param b_buffer the bit buffer being read.
+ * \param bit_pos the position of the next bit to read.
+ */
+void bbuf_seek(BitBuffer *b_buffer, size_t bit_pos) {
+    size_t byte = bit_pos / 8;
+
+    if(byte < b_buffer->offset || byte > b_buffer->offset + b_buffer->size) {
+        if(b_buffer->stream == NULL || fseek(b_buffer->stream, byte, SEEK_SET) != 0) {
+            printf("Error seek BitBuffer\n");
+            exit(EXIT_FAILURE);
+        }
+        b_buffer->offset = byte;
+        b_buffer->size = 0;
+    }
+
+    b_buffer->byte_pos = byte - b_buffer->offset;
+    b_buffer->bit_pos = byte * 8;
+    b_buffer->past_end = 0;
+    b_buffer->accumulator = 0;
+    b_buffer->nb_bits = 0;
+
+    if(bit_pos % 8 != 0)
+        bbuf_read_bits(b_buffer, bit_pos % 8);
+}
+
+/**
+ * Make the bits written to the specified buffer readable from the start, the
+ * last byte being completed with zeros and the buffer shrunk to its bytes.
+ * \param b_buffer the bit buffer which has been written.
+ */
+void bbuf_rewind(BitBuffer *b_buffer) {
+    if(b_buffer->nb_bits > 0)
+        bbuf_add_bits(b_buffer, 0, 8 - b_buffer->nb_bits);
+
+    b_buffer->size = b_buffer->byte_pos;
+    b_buffer->buffer = realloc(b_buffer->buffer, b_buffer->size > 0 ? b_buffer->size : 1);
+    if(b_buffer->buffer == NULL) {
+        printf("Error malloc BitBuffer\n");
+        exit(EXIT_FAILURE);
     }
+    b_buffer->offset = 0;
+    bbuf_seek(b_buffer, 0);
 }
 
 /**
@@ -123,14 +246,41 @@ void bbuf_open(BitBuffer *b_buffer, FILE *src) {
  * \param b_buffer the bit buffer from which a bit can be read.
  */
 int bbuf_read(BitBuffer *b_buffer) {
-    int byte = b_buffer->bit_pos / 8;
-    int bit_pos = b_buffer->bit_pos % 8;
-    int bit;
-    
-    bit = b_buffer->buffer[byte] & 1 << (7 - (bit_pos)) ? 1 : 0;
-    b_buffer->bit_pos++;
+    return bbuf_read_bits(b_buffer, 1);
+}
+
+/**
+ * Return the next bits of the specified bit buffer, the first one being the
+ * most significant. Bits past the end of the buffer are zeros.
+ * \param b_buffer the bit buffer from which bits can be read.
+ * \param nb_bits the number of bits to read, at most BBUF_MAX_BITS.
+ */
+uint64_t bbuf_read_bits(BitBuffer *b_buffer, int nb_bits) {
+    if(b_buffer->nb_bits < nb_bits) {
+        fill(b_buffer);
+        if(b_buffer->nb_bits < nb_bits) {
+            b_buffer->past_end = 1;
+            b_buffer->accumulator <<= nb_bits - b_buffer->nb_bits;
+            b_buffer->nb_bits = nb_bits;
+        }
+    }
+
+    b_buffer->nb_bits -= nb_bits;
+    b_buffer->bit_pos += nb_bits;
+    return b_buffer->accumulator >> b_buffer->nb_bits & LOW_BITS(nb_bits);
+}
 
-    return bit;
+/* Load whole bytes into the accumulator while they fit, reading the next
+window of a stream at the end of the buffer. */
+void fill(BitBuffer *b_buffer) {
+    while(b_buffer->nb_bits <= 56) {
+        if(b_buffer->byte_pos == b_buffer->size &&
+            (b_buffer->stream == NULL || !read_window(b_buffer)))
+            break;
+        b_buffer->accumulator = b_buffer->accumulator << 8 |
+            (unsigned char) b_buffer->buffer[b_buffer->byte_pos++];
+        b_buffer->nb_bits += 8;
+    }
 }
 
 /**
@@ -138,12 +288,14 @@ int bbuf_read(BitBuffer *b_buffer) {
  * \param b_buffer the bit buffer from which a color can be read.
  */
 uint32_t bbuf_read_color(BitBuffer *b_buffer) {
-    uint32_t color;
+    return bbuf_read_bits(b_buffer, 32);
+}
 
-    int i;
-    for (i = sizeof(uint32_t) * 8 - 1, color = 0; i >= 0; i--)
-    {
-        color |= bbuf_read(b_buffer) << i;
-    }
-    return color;
-}
\ No newline at end of file
+/**
+ * Return 1 if bits were read past the end of the data of the specified bit
+ * buffer since it was opened or moved, those bits being zeros.
+ * \param b_buffer the bit buffer being read.
+ */
+int bbuf_past_end(BitBuffer *b_buffer) {
+    return b_buffer->past_end;
+}
@@ -1,29 +1,66 @@
 /*
-Images are represented by a two dimension array of color.
+Images are represented by a heap-allocated array of colors.
 */
 
+#include <math.h>
+#include <string.h>
+
 #include "../include/bitmap.h"
+#include "../include/kernels.h"
 
 /**
- * Convert the specified img to a bitmap.
+ * Initialize a bitmap with the given dimensions. Every pixel is set to 0.
+ * The bitmap must be released using bitmap_clear.
+ * \param bitmap the bitmap to be initialized.
+ * \param width the width of the bitmap.
+ * \param height the height of the bitmap.
+ */
+void bitmap_init(Bitmap *bitmap, int width, int height)
+{
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->pixels = calloc((size_t) width * height, sizeof(Color));
+    if (bitmap->pixels == NULL && (size_t) width * height != 0)
+    {
+        printf("Error malloc Bitmap\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Release the pixels of the specified bitmap.
+ * \param bitmap the bitmap to be cleared.
+ */
+void bitmap_clear(Bitmap bitmap)
+{
+    free(bitmap.pixels);
+}
+
+/**
+ * Convert the specified img to a bitmap of the same dimensions. The bitmap
+ * must be released using bitmap_clear.
  * \param img the image to be converted.
  * \param bitmap the bitmap to receive the conversion.
  */
-void convert_img_to_bitmap(MLV_Image *img, Color bitmap[512][512])
+void convert_img_to_bitmap(MLV_Image *img, Bitmap *bitmap)
 {
     if(img == NULL) {
         printf("Image does not exist or is not recognized\n");
         exit(EXIT_FAILURE);
     }
 
-    size_t i, j;
+    int width, height;
+    MLV_get_image_size(img, &width, &height);
+    bitmap_init(bitmap, width, height);
+
+    int i, j;
     int red, green, blue, alpha;
-    for (i = 0; i < 512; i++)
+    for (j = 0; j < height; j++)
     {
-        for (j = 0; j < 512; j++)
+        for (i = 0; i < width; i++)
         {
             MLV_get_pixel_on_image(img, i, j, &red, &green, &blue, &alpha);
-            bitmap[i][j] = MLV_convert_rgba_to_color(red, green, blue, alpha);
+            BITMAP_PIXEL(bitmap, i, j) = MLV_convert_rgba_to_color(red, green, blue, alpha);
         }
     }
 }
@@ -34,28 +71,32 @@ void convert_img_to_bitmap(MLV_Image *img, Color bitmap[512][512])
  * \param area the area in the bitmap to determine the average color.
  * \return the average color of the bitmap in a specified area.
  */
-Color bitmap_average_color(Color bitmap[512][512], Area area)
+Color bitmap_average_color(Bitmap *bitmap, Area area)
 {
     size_t i, j, k;
-    int rgba_sum[4] = {0, 0, 0, 0};
+    long rgba_sum[4] = {0, 0, 0, 0};
+    int rgba[4] = {0, 0, 0, 0};
 
-    for (i = area.x; i < area.width + area.x; i++)
+    if (area.width <= 0 || area.height <= 0)
+        return 0;
+
+    for (j = area.y; j < area.height + area.y; j++)
     {
-        for (j = area.y; j < area.height + area.y; j++)
+        for (i = area.x; i < area.width + area.x; i++)
         {
-            rgba_sum[RED] += red(bitmap[i][j]);
-            rgba_sum[GREEN] += green(bitmap[i][j]);
-            rgba_sum[BLUE] += blue(bitmap[i][j]);
-            rgba_sum[ALPHA] += alpha(bitmap[i][j]);
+            rgba_sum[RED] += red(BITMAP_PIXEL(bitmap, i, j));
+            rgba_sum[GREEN] += green(BITMAP_PIXEL(bitmap, i, j));
+            rgba_sum[BLUE] += blue(BITMAP_PIXEL(bitmap, i, j));
+            rgba_sum[ALPHA] += alpha(BITMAP_PIXEL(bitmap, i, j));
         }
     }
 
     for (k = 0; k < 4; k++)
     {
-        rgba_sum[k] /= area.width * area.height;
+        rgba[k] = rgba_sum[k] / ((long) area.width * area.height);
     }
 
-    Color average_color = convert_rgba_to_color(rgba_sum);
+    Color average_color = convert_rgba_to_color(rgba);
 
     return average_color;
 }
@@ -67,20 +108,203 @@ Color bitmap_average_color(Color bitmap[512][512], Area area)
  * \param area the area in the bitmap to test.
  * \return the error valurn of the bitmap in a specified area.
  */
-long error_value(Color bitmap[512][512], Area area) {
+long error_value(Bitmap *bitmap, Area area) {
     long res = 0;
     Color p;
 
     p = bitmap_average_color(bitmap, area);
 
     int i, j;
-    for (i = 0; i < area.width; i++)
+    for (j = 0; j < area.height; j++)
     {
-        for (j = 0; j < area.height; j++)
+        for (i = 0; i < area.width; i++)
         {
-            res += color_distance(bitmap[i + area.x][j + area.y], p);
+            res += color_distance(BITMAP_PIXEL(bitmap, i + area.x, j + area.y), p);
         }
     }
     
     return res;
 }
+
+/**
+ * Compute the channel sums of a specified area, reading each of its pixels.
+ * \param bitmap the bitmap to be measured.
+ * \param area the area to be measured.
+ * \param sums the channel sums receiving the result.
+ */
+void bitmap_area_sums(Bitmap *bitmap, Area area, ChannelSums *sums)
+{
+    size_t k;
+    int y;
+
+    for (k = 0; k < 4; k++)
+    {
+        sums->sum[k] = 0;
+        sums->square[k] = 0;
+    }
+
+    for (y = area.y; y < area.y + area.height; y++)
+    {
+        kernel_row_sums(&BITMAP_PIXEL(bitmap, area.x, y), area.width, sums);
+    }
+}
+
+/**
+ * Initialize empty region statistics. The tables must be loaded using
+ * region_stats_load, and released using region_stats_clear.
+ * \param stats the region statistics to be initialized.
+ */
+void region_stats_init(RegionStats *stats)
+{
+    stats->area = (Area) {0, 0, 0, 0};
+    stats->capacity = 0;
+    stats->table = NULL;
+}
+
+/**
+ * Build the summed-area tables of an area of a bitmap, replacing the ones
+ * of the previous area. Only the areas inside it can be measured then.
+ * \param stats the region statistics.
+ * \param bitmap the bitmap to be measured.
+ * \param area the area covered by the tables.
+ */
+void region_stats_load(RegionStats *stats, Bitmap *bitmap, Area area)
+{
+    size_t y;
+    size_t columns = area.width + 1;
+    size_t size = columns * (area.height + 1);
+
+    if (size > stats->capacity)
+    {
+        free(stats->table);
+        stats->capacity = size;
+        stats->table = malloc(size * sizeof(ChannelSums));
+        if (stats->table == NULL)
+        {
+            printf("Error malloc RegionStats\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stats->area = area;
+
+    /* The first row and column are the empty sums. */
+    memset(stats->table, 0, columns * sizeof(ChannelSums));
+    for (y = 1; y <= (size_t) area.height; y++)
+    {
+        memset(&stats->table[y * columns], 0, sizeof(ChannelSums));
+    }
+
+    for (y = 0; y < (size_t) area.height; y++)
+    {
+        kernel_row_prefix(&BITMAP_PIXEL(bitmap, area.x, area.y + y), area.width,
+            &stats->table[y * columns + 1], &stats->table[(y + 1) * columns + 1]);
+    }
+}
+
+/**
+ * Release the summed-area tables of the specified region statistics.
+ * \param stats the region statistics to be cleared.
+ */
+void region_stats_clear(RegionStats stats)
+{
+    free(stats.table);
+}
+
+/**
+ * Compute the channel sums of a specified area in constant time.
+ * \param stats the region statistics of the bitmap.
+ * \param area the area to be measured, inside the area of the tables.
+ * \param sums the channel sums receiving the result.
+ */
+void region_sums(RegionStats *stats, Area area, ChannelSums *sums)
+{
+    size_t columns = stats->area.width + 1;
+    size_t x = area.x - stats->area.x, y = area.y - stats->area.y;
+    ChannelSums *a = &stats->table[y * columns + x];
+    ChannelSums *b = &stats->table[y * columns + x + area.width];
+    ChannelSums *c = &stats->table[(y + area.height) * columns + x];
+    ChannelSums *d = &stats->table[(y + area.height) * columns + x + area.width];
+
+    size_t k;
+    for (k = 0; k < 4; k++)
+    {
+        sums->sum[k] = d->sum[k] - b->sum[k] - c->sum[k] + a->sum[k];
+        sums->square[k] = d->square[k] - b->square[k] - c->square[k] + a->square[k];
+    }
+}
+
+/**
+ * Evaluate the average color of a specified area in constant time.
+ * \param stats the region statistics of the bitmap.
+ * \param area the area in the bitmap to determine the average color.
+ * \return the average color of the area.
+ */
+Color region_average_color(RegionStats *stats, Area area)
+{
+    ChannelSums sums;
+    region_sums(stats, area, &sums);
+    return sums_average_color(&sums, (long) area.width * area.height);
+}
+
+/**
+ * Return the error value of a specified area in constant time.
+ * See sums_error_value.
+ * \param stats the region statistics of the bitmap.
+ * \param area the area in the bitmap to test.
+ * \return the error value of the area.
+ */
+long region_error_value(RegionStats *stats, Area area)
+{
+    ChannelSums sums;
+    region_sums(stats, area, &sums);
+    return sums_error_value(&sums, (long) area.width * area.height);
+}
+
+/**
+ * Return the average color of a set of pixels from their channel sums.
+ * \param sums the channel sums of the pixels.
+ * \param nb_pixels the number of pixels.
+ * \return the average color, truncated like bitmap_average_color.
+ */
+Color sums_average_color(ChannelSums *sums, long nb_pixels)
+{
+    int rgba[4] = {0, 0, 0, 0};
+    size_t k;
+
+    if (nb_pixels <= 0)
+        return 0;
+
+    for (k = 0; k < 4; k++)
+    {
+        rgba[k] = sums->sum[k] / nb_pixels;
+    }
+    return convert_rgba_to_color(rgba);
+}
+
+/**
+ * Return the error value of a set of pixels from their channel sums. The
+ * squared distances to the mean color are summed per channel (variance), and
+ * the error is sqrt(n * sum), which bounds the sum of the color distances
+ * computed by error_value. The error is 0 only for uniform pixels.
+ * \param sums the channel sums of the pixels.
+ * \param nb_pixels the number of pixels.
+ * \return the error value of the pixels.
+ */
+long sums_error_value(ChannelSums *sums, long nb_pixels)
+{
+    double squared_error = 0;
+    size_t k;
+
+    if (nb_pixels <= 0)
+        return 0;
+
+    for (k = 0; k < 4; k++)
+    {
+        double mean = (double) sums->sum[k] / nb_pixels;
+        squared_error += (double) sums->square[k] - (double) sums->sum[k] * mean;
+    }
+    if (squared_error <= 0)
+        return 0;
+
+    return sqrt(nb_pixels * squared_error);
+}
@@ -0,0 +1,155 @@
+/*
+Budgeted quadtree construction using a priority queue of leaves ordered by
+their error value.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../include/budget.h"
+#include "../include/encode.h"
+
+/* Number of splits between two checks of the time limit. */
+#define CLOCK_PERIOD 1024
+
+/**
+ * A leaf waiting to be split, with the area it covers.
+ */
+typedef struct {
+    long error;
+    Quadtree leaf;
+    Area area;
+} LeafEntry;
+
+/**
+ * A binary max-heap of leaves ordered by error value.
+ */
+typedef struct {
+    LeafEntry *entries;
+    size_t size;
+    size_t capacity;
+} LeafQueue;
+
+static void lq_push(LeafQueue *queue, LeafEntry entry);
+static LeafEntry lq_pop(LeafQueue *queue);
+static int budget_exceeded(BuildBudget budget, size_t leaves, size_t internal_nodes, clock_t start);
+
+/**
+ * Create a quadtree from a specified bitmap within a budget. Starting from
+ * a single leaf, the leaf with the largest error is split into four until
+ * a split would exceed the budget or every leaf is uniform. Stopping at any
+ * point leaves the best tree found so far. Each split reads the pixels of
+ * the split leaf once, to measure its children.
+ * \param bitmap the bitmap from which to construct the quadtree.
+ * \param budget the limits of the construction.
+ * \return the quadtree generated from the bitmap.
+ */
+Quadtree budget_create_quadtree(Bitmap *bitmap, BuildBudget budget)
+{
+    ChannelSums sums;
+    LeafQueue queue = {NULL, 0, 0};
+    LeafEntry entry;
+    Area area = {0, 0, bitmap->width, bitmap->height};
+    size_t leaves = 1, internal_nodes = 0;
+    clock_t start = clock();
+    NodeArena *arena = arena_create();
+    size_t i;
+
+    bitmap_area_sums(bitmap, area, &sums);
+    Quadtree tree = qt_create_arena_node(arena, sums_average_color(&sums, (long) area.width * area.height));
+    entry.error = sums_error_value(&sums, (long) area.width * area.height);
+    entry.leaf = tree;
+    entry.area = area;
+    if (entry.error > 0)
+        lq_push(&queue, entry);
+
+    while (queue.size > 0)
+    {
+        /* A split turns a leaf into an internal node and adds four leaves. */
+        if (budget_exceeded(budget, leaves + QT_MAX_NODE - 1, internal_nodes + 1, start))
+            break;
+
+        entry = lq_pop(&queue);
+        for (i = 0; i < QT_MAX_NODE; i++)
+        {
+            LeafEntry child;
+            long nb_pixels;
+            child.area = get_sub_area(entry.area, i);
+            nb_pixels = (long) child.area.width * child.area.height;
+            bitmap_area_sums(bitmap, child.area, &sums);
+            child.leaf = qt_create_arena_node(arena, sums_average_color(&sums, nb_pixels));
+            child.error = sums_error_value(&sums, nb_pixels);
+            entry.leaf->nodes[i] = child.leaf;
+
+            if (child.error > 0)
+                lq_push(&queue, child);
+        }
+        leaves += QT_MAX_NODE - 1;
+        internal_nodes++;
+    }
+
+    free(queue.entries);
+
+    qt_cache_aggregates(tree);
+    arena->root = tree;
+    return tree;
+}
+
+/* Return 1 if a tree of the specified size, or the elapsed time, exceeds the budget. */
+int budget_exceeded(BuildBudget budget, size_t leaves, size_t internal_nodes, clock_t start)
+{
+    if (budget.max_nodes != 0 && leaves + internal_nodes > budget.max_nodes)
+        return 1;
+    if (budget.max_bytes != 0 && enc_nodes_size(leaves, internal_nodes, budget.dest) > budget.max_bytes)
+        return 1;
+    /* Each split adds one internal node. */
+    if (budget.max_seconds > 0 && internal_nodes % CLOCK_PERIOD == 0)
+        return (double) (clock() - start) / CLOCKS_PER_SEC > budget.max_seconds;
+
+    return 0;
+}
+
+/* Add a leaf to the queue, moving it up while its parent has a lower error. */
+void lq_push(LeafQueue *queue, LeafEntry entry)
+{
+    if (queue->size == queue->capacity)
+    {
+        queue->capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+        queue->entries = realloc(queue->entries, queue->capacity * sizeof(LeafEntry));
+        if (queue->entries == NULL)
+        {
+            printf("Error malloc LeafQueue\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t i = queue->size++;
+    while (i > 0 && queue->entries[(i - 1) / 2].error < entry.error)
+    {
+        queue->entries[i] = queue->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->entries[i] = entry;
+}
+
+/* Remove the leaf with the largest error from the queue. */
+LeafEntry lq_pop(LeafQueue *queue)
+{
+    LeafEntry top = queue->entries[0];
+    LeafEntry last = queue->entries[--queue->size];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < queue->size)
+    {
+        if (child + 1 < queue->size && queue->entries[child + 1].error > queue->entries[child].error)
+            child++;
+        if (queue->entries[child].error <= last.error)
+            break;
+        queue->entries[i] = queue->entries[child];
+        i = child;
+    }
+    queue->entries[i] = last;
+
+    return top;
+}
@@ -72,10 +72,10 @@ Channel alpha(Color value) {
  * \return the distance between two colors.
  */
 double color_distance(Color p1, Color p2) {
-    return sqrt(
-            pow(red(p1) - red(p2), 2) +
-            pow(blue(p1) - blue(p2), 2) +
-            pow(green(p1) - green(p2), 2) +
-            pow(alpha(p1) - alpha(p2), 2)
-        );
+    int r = red(p1) - red(p2);
+    int g = green(p1) - green(p2);
+    int b = blue(p1) - blue(p2);
+    int a = alpha(p1) - alpha(p2);
+
+    return sqrt(r * r + g * g + b * b + a * a);
 }
@@ -2,10 +2,11 @@
 Set of functions to write down a quadtree into a dot file.
 */
 #include "../include/diagram.h"
+#include "../include/node_map.h"
 
 
 static void write_header(FILE *f);
-static void write_tree(FILE *f , Quadtree a);
+static void write_tree(FILE *f , Quadtree a, NodeMap *visited);
 static void write_end(FILE *f);
 static void create_file(FILE *f, Quadtree a);
 static void create_dot(Quadtree head);
@@ -16,9 +17,8 @@ void write_header(FILE *f) {
     fprintf(f, "edge [arrowhead=none,arrowtail=dot];\n");
 }
 
-void write_tree(FILE *f , Quadtree a) {
-    if(a->visited) return;
-    a->visited = 1;
+void write_tree(FILE *f , Quadtree a, NodeMap *visited) {
+    if(!nmap_put(visited, a, 0)) return;
 
     if(a != NULL) fprintf(f, "\"n%o\" [label=\"\"][style=filled,fillcolor=\"#%08x\"]\n", a, a->color);
     
@@ -27,7 +27,7 @@ void write_tree(FILE *f , Quadtree a) {
     {
         if(a->nodes[i] != NULL) {
             fprintf(f, "\"n%o\":value:c -> \"n%o\":value\n", a, a->nodes[i]);
-            write_tree(f, a->nodes[i]);
+            write_tree(f, a->nodes[i], visited);
         }
     }
 }
@@ -37,13 +37,17 @@ void write_end(FILE *f) {
 }
 
 void create_file(FILE *f, Quadtree a) {
+    NodeMap visited;
+    nmap_init(&visited);
+
     write_header(f);
-    write_tree(f, a);
+    write_tree(f, a, &visited);
     write_end(f);
+
+    nmap_clear(visited);
 }
 
 void create_dot(Quadtree head) {
-    qt_reset_visited_nodes(head);
     FILE *f = fopen("visualise.dot", "w");
     create_file(f, head);
     fclose(f);
@@ -10,16 +10,18 @@ static void draw_node(int x, int y, Node node, Area area, draw_style style);
  * \param x the 'x' in the coordinate.
  * \param y the 'y' in the coordinate.
  * \param root the quadtree to be drawn.
+ * \param width the width of the drawn image.
+ * \param height the height of the drawn image.
  * \param style the drawing style of the quadtree.
  * \param delay the delay between each step.
  */
-void draw_quadtree_process(int x, int y, Quadtree root, draw_style style, int delay)
+void draw_quadtree_process(int x, int y, Quadtree root, int width, int height, draw_style style, int delay)
 {
     int h = qt_height(root) + 1;
     size_t i;
     for (i = 1; i <= h; i++)
     {
-        draw_by_level(x, y, root, i, (Area) {0, 0, IMG_SIZE, IMG_SIZE}, style);
+        draw_by_level(x, y, root, i, (Area) {0, 0, width, height}, style);
         MLV_actualise_window();
         MLV_wait_milliseconds(delay);
     }
@@ -55,6 +57,10 @@ void draw_node_with_box(int x, int y, Node node, Area area)
 }
 
 void draw_node(int x, int y, Node node, Area area, draw_style style) {
+    /* Sub-areas of one pixel wide areas are empty. */
+    if (area.width <= 0 || area.height <= 0)
+        return;
+
     switch (style)
     {
     case STANDARD:
@@ -76,11 +82,39 @@ void draw_node(int x, int y, Node node, Area area, draw_style style) {
  * \param x the 'x' in the coordinate.
  * \param y the 'y' in the coordinate.
  * \param tree the quadtree to be displayed.
+ * \param width the width of the drawn image.
+ * \param height the height of the drawn image.
  * \param style the drawing style of the quadtree.
  */
-void draw_quadtree_image(int x, int y, Quadtree tree, draw_style style)
+void draw_quadtree_image(int x, int y, Quadtree tree, int width, int height, draw_style style)
+{
+    _draw_quadtree_image(x, y, tree, (Area) {0, 0, width, height}, style);
+}
+
+/**
+ * Compute the dimensions of an image scaled down to fit in a square,
+ * keeping its proportions. Images already fitting are not scaled.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param size the side of the square.
+ * \param fit_width the pointer which will receive the scaled width.
+ * \param fit_height the pointer which will receive the scaled height.
+ */
+void draw_fit_size(int width, int height, int size, int *fit_width, int *fit_height)
 {
-    _draw_quadtree_image(x, y, tree, (Area) {0, 0, IMG_SIZE, IMG_SIZE}, style);
+    *fit_width = width;
+    *fit_height = height;
+
+    if (width > size && width >= height)
+    {
+        *fit_width = size;
+        *fit_height = (long) height * size / width;
+    }
+    else if (height > size)
+    {
+        *fit_width = (long) width * size / height;
+        *fit_height = size;
+    }
 }
 
 void _draw_quadtree_image(int x, int y, Quadtree tree, Area area, draw_style style) {
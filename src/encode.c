@@ -9,67 +9,193 @@
 #include "../include/bit_buffer.h"
 #include "../include/encode.h"
 #include "../include/draw.h"
+#include "../include/linear_quadtree.h"
+#include "../include/minimize.h"
+#include "../include/node_map.h"
+#include "../include/node_factory.h"
+#include "../include/range_coder.h"
+#include "../include/palette.h"
 
 #define LEAF 1
 #define NODE 0
 
+/* Magic number opening the qtn and qtc files, followed by the image width and
+height. Files without it come from earlier versions and hold 512x512 images. */
+#define QT_MAGIC 0x59515401
+#define LEGACY_IMG_SIZE 512
+
+/* Magic number opening the qte files, followed by the image width and height
+and by the bytes of the range coder. */
+#define QTE_MAGIC 0x59514501
+
+/* Largest side of the image of a qte file, the depth of its pixels being
+counted in an int. */
+#define QTE_MAX_SIDE (1 << 30)
+
+/* Number of depths with their own contexts, the deeper nodes sharing the
+last ones. */
+#define QTE_DEPTHS 16
+
+/* Magic number opening the qtp files, followed by the image width and
+height, the size of the palette and its colors. */
+#define QTP_MAGIC 0x59515001
+
+/* Magic number opening the binary gmn and gmc files, followed by the image
+width and height. Its first byte cannot start a text file. */
+#define GM_MAGIC 0x89474d01
+
+/* Start of the header line of the text gmn and gmc files, holding the image
+width and height. */
+#define GM_HEADER "#size"
+
+/* Number of lines first allocated for a text gm file. */
+#define GM_LINES 1024
+
+/**
+ * Contexts of the range coder of a qte file. The structure bit of a node
+ * depends on its depth and on the kind of its previous siblings, a leaf color
+ * on the color of the previous leaf.
+ */
+typedef struct {
+    /* Leaf or internal node, by depth and pattern of the previous siblings,
+    a leading 1 followed by a bit for each one being a leaf. */
+    RcProb structure[QTE_DEPTHS][1 << QT_MAX_NODE];
+    /* Leaf of the color of the previous leaf, by depth and whether the
+    previous leaf repeated its own previous one. */
+    RcProb repeat[QTE_DEPTHS][2];
+    /* Difference of a channel with its prediction from the previous leaf, by
+    channel and whether the difference of the previous channel is zero. */
+    RcProb channels[NB_CHANNELS][2][RC_BYTE_PROBS];
+    Color previous;
+    int repeated;
+    /* Depth of the areas of one pixel, whose nodes are leaves. */
+    int max_depth;
+} QteModel;
+
+/**
+ * A line of a gm file, the node of an identification number.
+ */
+typedef struct {
+    Color color;
+    int is_leaf;
+    int children[QT_MAX_NODE];
+} GmLine;
+
 /* Quadtree. */
-static void save_to_qt(Quadtree tree, const char* filename, color_format color_format);
-static Quadtree load_qt(const char* filename, color_format color_format);
+static void save_to_qt(Quadtree tree, int width, int height, const char* filename, color_format color_format);
+static Quadtree load(const char* filename, int *width, int *height, int hash_consing);
+static Quadtree load_qt(const char* filename, int *width, int *height, color_format color_format, int hash_consing);
 
+static void init_qt_bit_buffer(BitBuffer *b_buffer, size_t leaves, size_t internal_nodes, int width, int height, color_format color_format);
+static void put_qt_bit_buffer(BitBuffer *b_buffer, const char* filename);
 static void add_qt_to_bit_buffer(BitBuffer *b_buffer, Quadtree tree, color_format color_format);
-static Quadtree create_quadtree_from_qt(BitBuffer *b_buffer, color_format color_format);
+static void add_leaf(BitBuffer *b_buffer, Color color, color_format color_format);
+static void save_linear_to_qt(LinearQuadtree *lqt, int width, int height, const char* filename, color_format color_format);
+static void add_linear_node(int is_leaf, Color color, void *data);
+static Quadtree create_quadtree_from_qt(BitBuffer *b_buffer, color_format color_format, NodeFactory *factory,
+    int depth, int max_depth);
+
+/* Entropy coded quadtree. */
+static void init_qte_model(QteModel *model, int width, int height);
+static void encode_qte(BitBuffer *b_buffer, Quadtree tree, int width, int height);
+static void encode_qte_node(RangeEncoder *encoder, QteModel *model, Quadtree tree, int depth, int pattern);
+static void encode_qte_color(RangeEncoder *encoder, QteModel *model, Color color, int depth);
+static Quadtree decode_qte_node(RangeDecoder *decoder, QteModel *model, int depth, int pattern, NodeFactory *factory);
+static Color decode_qte_color(RangeDecoder *decoder, QteModel *model, int depth);
+static int qte_context_depth(int depth);
+static int zigzag(int difference);
+static int unzigzag(int value);
+static Quadtree load_qte(const char* filename, int *width, int *height, int hash_consing);
+static size_t qte_size(Quadtree tree, int width, int height);
+static int pixel_depth(int width, int height);
+
+/* Palette indexed quadtree. */
+static void add_qtp_to_bit_buffer(BitBuffer *b_buffer, Quadtree tree, PaletteMap *map, int index_bits);
+static int copy_qtp_nodes(BitBuffer *src, BitBuffer *dest, IndexedQuadtree *indexed, int depth, int max_depth);
+static Quadtree create_quadtree_from_indexed(IndexedQuadtree *indexed, NodeFactory *factory);
+static void visit_indexed(IndexedQuadtree *indexed, Area area, void (*visit)(Area area, Color color, void *data), void *data);
+static Quadtree load_qtp(const char* filename, int *width, int *height, int hash_consing);
+static size_t qtp_size(Quadtree tree, int width, int height, size_t max_colors);
 
 /* Minimized graph. */
-static void add_gm_to_file(Quadtree tree, FILE *file, color_format color_format);
-static Quadtree create_quadtree_from_gm(FILE* file, size_t nb_node, color_format color_format);
+static void add_gm_to_bit_buffer(BitBuffer *b_buffer, size_t id, SubtreeClasses *classes, color_format color_format);
+static void add_varint(BitBuffer *b_buffer, size_t value);
+static size_t read_varint(BitBuffer *b_buffer);
+static size_t varint_size(size_t value);
+static Quadtree create_quadtree_from_gm(BitBuffer *b_buffer, int *width, int *height, color_format color_format,
+    int hash_consing);
+static Quadtree create_quadtree_from_text_gm(FILE* file, int *width, int *height, color_format color_format,
+    int hash_consing);
 
-static void save_to_gm(Quadtree tree, const char* filename, color_format color_format);
-static Quadtree load_gm(const char* filename, color_format color_format);
+static void save_to_gm(Quadtree tree, int width, int height, const char* filename, color_format color_format);
+static Quadtree load_gm(const char* filename, int *width, int *height, color_format color_format, int hash_consing);
 
-static size_t count_lines(const char* filename);
+static void parse_value_gmc(GmLine **lines, size_t *size, char* line);
+static void parse_value_gmn(GmLine **lines, size_t *size, char* line);
+static int parse_values(char *line, int value[5]);
+static GmLine *reserve_lines(GmLine *lines, size_t *size, int value[5], size_t nb_value);
+static Quadtree make_gm_node(GmLine *lines, Quadtree *nodes, char *referenced, int id, NodeFactory *factory);
+static size_t qt_size(Quadtree tree, color_format color_format);
+static size_t qt_layout_size(size_t leaves, size_t internal_nodes, color_format color_format);
+static size_t gm_size(Quadtree tree, color_format color_format);
 
 /**
  * Save a quadtree to the specified filename with qtn format.
  * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
  * \param filename the filename of the saved quadtree.
  */
-void enc_save_to_qtn(Quadtree tree, const char* filename) {
-    save_to_qt(tree, filename, BIT);
+void enc_save_to_qtn(Quadtree tree, int width, int height, const char* filename) {
+    save_to_qt(tree, width, height, filename, BIT);
 }
 
 /**
  * Save a quadtree to the specified filename with qtc format.
  * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
  * \param filename the filename of the saved quadtree.
  */
-void enc_save_to_qtc(Quadtree tree, const char* filename) {
-    save_to_qt(tree, filename, COLOR);
+void enc_save_to_qtc(Quadtree tree, int width, int height, const char* filename) {
+    save_to_qt(tree, width, height, filename, COLOR);
 }
 
-void save_to_qt(Quadtree tree, const char* filename, color_format color_format) {
+void save_to_qt(Quadtree tree, int width, int height, const char* filename, color_format color_format) {
     BitBuffer bit_buffer;
     size_t leaves, internal_nodes;
 
-    qt_get_infos(tree, &leaves, &internal_nodes);
+    qt_get_tree_infos(tree, &leaves, &internal_nodes);
 
-    size_t size;
+    init_qt_bit_buffer(&bit_buffer, leaves, internal_nodes, width, height, color_format);
+    add_qt_to_bit_buffer(&bit_buffer, tree, color_format);
+    put_qt_bit_buffer(&bit_buffer, filename);
+}
+
+/* Initializing a buffer sized for a quadtree and holding the header. */
+void init_qt_bit_buffer(BitBuffer *b_buffer, size_t leaves, size_t internal_nodes, int width, int height, color_format color_format) {
+    size_t size = 3 * sizeof(uint32_t); /* Magic number, width and height. */
     if(color_format == BIT)
-        size = leaves/4 + internal_nodes/8; /* BIT: 2 bits for a leaf, 1 for an internal node. */
+        size += leaves/4 + internal_nodes/8; /* BIT: 2 bits for a leaf, 1 for an internal node. */
     else        
-        size = 4*leaves + leaves/8 + internal_nodes/8; /* COLOR:(4*8 + 1) bits for a leaf, 1 for an internal node. */
+        size += 4*leaves + leaves/8 + internal_nodes/8; /* COLOR:(4*8 + 1) bits for a leaf, 1 for an internal node. */
 
-    bbuf_init(&bit_buffer, size);
-    add_qt_to_bit_buffer(&bit_buffer, tree, color_format);
+    bbuf_init(b_buffer, size);
+    bbuf_add_color(b_buffer, QT_MAGIC);
+    bbuf_add_color(b_buffer, width);
+    bbuf_add_color(b_buffer, height);
+}
 
+/* Writing a buffer to a file and releasing it. */
+void put_qt_bit_buffer(BitBuffer *b_buffer, const char* filename) {
     FILE *dest = fopen(filename, "w");
     if(dest == NULL) {
         printf("Couldn't save quadtree to qt\n");
         exit(EXIT_FAILURE);
     }
-    bbuf_put(dest, &bit_buffer);
+    bbuf_put(dest, b_buffer);
 
-    bbuf_clear(bit_buffer);
+    bbuf_clear(*b_buffer);
     fclose(dest);
 }
 
@@ -78,11 +204,7 @@ void add_qt_to_bit_buffer(BitBuffer *b_buffer, Quadtree tree, color_format color
     if(tree == NULL) return;
 
     if(qt_is_leaf(tree)) {
-        bbuf_add(b_buffer, LEAF);
-        if(color_format == BIT)
-            bbuf_add(b_buffer, convert_to_bit_color(tree->color));
-        else
-            bbuf_add_color(b_buffer, tree->color);
+        add_leaf(b_buffer, tree->color, color_format);
     }
     else {
         bbuf_add(b_buffer, NODE);
@@ -95,25 +217,93 @@ void add_qt_to_bit_buffer(BitBuffer *b_buffer, Quadtree tree, color_format color
     }
 }
 
+/* Adding the bits of a leaf, its flag and color being written at once. */
+void add_leaf(BitBuffer *b_buffer, Color color, color_format color_format) {
+    if(color_format == BIT)
+        bbuf_add_bits(b_buffer, LEAF << 1 | convert_to_bit_color(color), 2);
+    else
+        bbuf_add_bits(b_buffer, (uint64_t) LEAF << 32 | color, 33);
+}
+
+/**
+ * Save a linear quadtree to the specified filename with qtn format. The file
+ * is the same as the one of the equivalent quadtree.
+ * \param lqt the linear quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param filename the filename of the saved quadtree.
+ */
+void enc_save_linear_to_qtn(LinearQuadtree *lqt, int width, int height, const char* filename) {
+    save_linear_to_qt(lqt, width, height, filename, BIT);
+}
+
+/**
+ * Save a linear quadtree to the specified filename with qtc format. The file
+ * is the same as the one of the equivalent quadtree.
+ * \param lqt the linear quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param filename the filename of the saved quadtree.
+ */
+void enc_save_linear_to_qtc(LinearQuadtree *lqt, int width, int height, const char* filename) {
+    save_linear_to_qt(lqt, width, height, filename, COLOR);
+}
+
+/* Buffer and format of the nodes visited in a linear quadtree. */
+typedef struct {
+    BitBuffer *b_buffer;
+    color_format color_format;
+} LinearWriter;
+
+void save_linear_to_qt(LinearQuadtree *lqt, int width, int height, const char* filename, color_format color_format) {
+    BitBuffer bit_buffer;
+    LinearWriter writer;
+
+    /* Every internal node has 4 children. */
+    init_qt_bit_buffer(&bit_buffer, lqt->size, lqt->size > 0 ? (lqt->size - 1) / 3 : 0, width, height, color_format);
+
+    writer.b_buffer = &bit_buffer;
+    writer.color_format = color_format;
+    lqt_preorder(lqt, add_linear_node, &writer);
+
+    put_qt_bit_buffer(&bit_buffer, filename);
+}
+
+/* Adding the bits of a node of a linear quadtree. */
+void add_linear_node(int is_leaf, Color color, void *data) {
+    LinearWriter *writer = data;
+
+    if(is_leaf) {
+        add_leaf(writer->b_buffer, color, writer->color_format);
+    }
+    else {
+        bbuf_add(writer->b_buffer, NODE);
+    }
+}
+
 /**
  * Load a quadtree from a specified file with the qtn format.
  * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
  * \return the loaded quadtree.
  */
-Quadtree enc_load_qtn(const char* filename) {
-    return load_qt(filename, BIT);
+Quadtree enc_load_qtn(const char* filename, int *width, int *height) {
+    return load_qt(filename, width, height, BIT, 0);
 }
 
 /**
  * Load a quadtree from a specified file with the qtc format.
  * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
  * \return the loaded quadtree.
  */
-Quadtree enc_load_qtc(const char* filename) {
-    return load_qt(filename, COLOR);
+Quadtree enc_load_qtc(const char* filename, int *width, int *height) {
+    return load_qt(filename, width, height, COLOR, 0);
 }
 
-Quadtree load_qt(const char* filename, color_format color_format) {
+Quadtree load_qt(const char* filename, int *width, int *height, color_format color_format, int hash_consing) {
     Quadtree tree = NULL;
     FILE *src = fopen(filename, "r");
     if(src == NULL) {
@@ -124,224 +314,914 @@ Quadtree load_qt(const char* filename, color_format color_format) {
     BitBuffer bit_buffer;
     bbuf_open(&bit_buffer, src);
 
-    tree = create_quadtree_from_qt(&bit_buffer, color_format);
+    *width = LEGACY_IMG_SIZE;
+    *height = LEGACY_IMG_SIZE;
+    if(bit_buffer.size >= 3 * sizeof(uint32_t) && bbuf_read_color(&bit_buffer) == QT_MAGIC) {
+        *width = bbuf_read_color(&bit_buffer);
+        *height = bbuf_read_color(&bit_buffer);
+    } else {
+        bbuf_seek(&bit_buffer, 0);
+    }
+
+    NodeArena *arena = arena_create();
+    NodeFactory factory;
+    nfactory_init(&factory, arena, hash_consing);
+    tree = create_quadtree_from_qt(&bit_buffer, color_format, &factory, 0, pixel_depth(*width, *height));
+    nfactory_clear(factory);
+
+    if(tree == NULL || bbuf_past_end(&bit_buffer)) {
+        printf("Invalid qt file\n");
+        arena_release(arena);
+        tree = NULL;
+    } else {
+        arena->root = tree;
+    }
 
     bbuf_clear(bit_buffer);
     fclose(src);
     return tree;
 }
 
-/* Creating a quadtree from a qt file. */
-Quadtree create_quadtree_from_qt(BitBuffer *b_buffer, color_format color_format) {
+/* Creating a quadtree from a qt file, the children before their parent.
+Return NULL at the end of the data or if a node of one pixel is not a leaf,
+the nodes already made staying in the arena of the factory. */
+Quadtree create_quadtree_from_qt(BitBuffer *b_buffer, color_format color_format, NodeFactory *factory,
+    int depth, int max_depth) {
     int bit = bbuf_read(b_buffer);
-    Quadtree tree = NULL;
-
-    tree = qt_create_node(MLV_COLOR_GREY);
+    if(bbuf_past_end(b_buffer)) return NULL;
 
     if(bit == NODE) {
+        Quadtree children[QT_MAX_NODE];
         size_t i;
+        if(depth >= max_depth) return NULL;
         for (i = 0; i < QT_MAX_NODE; i++)
         {
-            tree->nodes[i] = create_quadtree_from_qt(b_buffer, color_format);
+            children[i] = create_quadtree_from_qt(b_buffer, color_format, factory, depth + 1, max_depth);
+            if(children[i] == NULL) return NULL;
         }
+        return nfactory_make(factory, MLV_COLOR_GREY, children);
     }
-    else {
-        if(color_format == BIT)
-            tree->color = bbuf_read(b_buffer) ? MLV_COLOR_WHITE : MLV_COLOR_BLACK;
-        else
-            tree->color = bbuf_read_color(b_buffer);
+
+    if(color_format == BIT)
+        return nfactory_make(factory, bbuf_read(b_buffer) ? MLV_COLOR_WHITE : MLV_COLOR_BLACK, NULL);
+    return nfactory_make(factory, bbuf_read_color(b_buffer), NULL);
+}
+
+/**
+ * Save a quadtree to the specified filename with qte format, the qtc file
+ * coded with an adaptive range coder.
+ * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param filename the filename of the saved quadtree.
+ */
+void enc_save_to_qte(Quadtree tree, int width, int height, const char* filename) {
+    BitBuffer bit_buffer;
+
+    encode_qte(&bit_buffer, tree, width, height);
+    put_qt_bit_buffer(&bit_buffer, filename);
+}
+
+/**
+ * Load a quadtree from a specified file with the qte format.
+ * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
+ * \return the loaded quadtree, NULL if the file is not a qte file.
+ */
+Quadtree enc_load_qte(const char* filename, int *width, int *height) {
+    return load_qte(filename, width, height, 0);
+}
+
+/* Contexts which have not coded anything, the first leaf being compared with
+a transparent black one. */
+void init_qte_model(QteModel *model, int width, int height) {
+    rcoder_init_probs(&model->structure[0][0], sizeof(model->structure) / sizeof(RcProb));
+    rcoder_init_probs(&model->repeat[0][0], sizeof(model->repeat) / sizeof(RcProb));
+    rcoder_init_probs(&model->channels[0][0][0], sizeof(model->channels) / sizeof(RcProb));
+    model->previous = 0;
+    model->repeated = 0;
+    model->max_depth = pixel_depth(width, height);
+}
+
+/* Initializing a buffer holding the header and the coded tree. */
+void encode_qte(BitBuffer *b_buffer, Quadtree tree, int width, int height) {
+    RangeEncoder encoder;
+    QteModel model;
+
+    bbuf_init(b_buffer, 3 * sizeof(uint32_t) + qt_count_node(tree) / 4);
+    bbuf_add_color(b_buffer, QTE_MAGIC);
+    bbuf_add_color(b_buffer, width);
+    bbuf_add_color(b_buffer, height);
+
+    init_qte_model(&model, width, height);
+    rcoder_encoder_init(&encoder, b_buffer);
+    encode_qte_node(&encoder, &model, tree, 0, 0);
+    rcoder_flush(&encoder);
+}
+
+/* Coding a node in pre-order as qtc files do. The nodes of one pixel are
+leaves, so their structure bit is left out. */
+void encode_qte_node(RangeEncoder *encoder, QteModel *model, Quadtree tree, int depth, int pattern) {
+    if(depth >= model->max_depth) {
+        encode_qte_color(encoder, model, tree->color, depth);
+        return;
+    }
+
+    rcoder_encode(encoder, &model->structure[qte_context_depth(depth)][pattern], qt_is_leaf(tree));
+    if(qt_is_leaf(tree)) {
+        encode_qte_color(encoder, model, tree->color, depth);
+        return;
+    }
+
+    size_t i;
+    pattern = 1;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        encode_qte_node(encoder, model, tree->nodes[i], depth + 1, pattern);
+        pattern = pattern << 1 | qt_is_leaf(tree->nodes[i]);
+    }
+}
+
+/* Coding a leaf color as a repeat of the previous leaf, or as the differences
+of its channels with it. The change of red is added to the predictions of
+green and blue, which tend to follow it. */
+void encode_qte_color(RangeEncoder *encoder, QteModel *model, Color color, int depth) {
+    int repeated = color == model->previous;
+    int zero = 1, i;
+
+    rcoder_encode(encoder, &model->repeat[qte_context_depth(depth)][model->repeated], repeated);
+    int red_change = 0;
+    for (i = 0; i < NB_CHANNELS && !repeated; i++)
+    {
+        int shift = 8 * (NB_CHANNELS - 1 - i);
+        int predicted = (model->previous >> shift) + (i == 1 || i == 2 ? red_change : 0);
+        int difference = ((color >> shift) - predicted) & 0xFF;
+        rcoder_encode_byte(encoder, model->channels[i][zero], zigzag(difference));
+        if(i == 0) red_change = ((color >> shift) & 0xFF) - ((model->previous >> shift) & 0xFF);
+        zero = difference == 0;
+    }
+
+    model->previous = color;
+    model->repeated = repeated;
+}
+
+/* Decoding a node coded by encode_qte_node, its children first. Return NULL
+once the decoder reads past the end of the data, the nodes already made
+staying in the arena of the factory. */
+Quadtree decode_qte_node(RangeDecoder *decoder, QteModel *model, int depth, int pattern, NodeFactory *factory) {
+    if(bbuf_past_end(decoder->b_buffer)) return NULL;
+
+    if(depth >= model->max_depth ||
+        rcoder_decode(decoder, &model->structure[qte_context_depth(depth)][pattern]) == LEAF)
+        return nfactory_make(factory, decode_qte_color(decoder, model, depth), NULL);
+
+    Quadtree children[QT_MAX_NODE];
+    size_t i;
+    pattern = 1;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        children[i] = decode_qte_node(decoder, model, depth + 1, pattern, factory);
+        if(children[i] == NULL) return NULL;
+        pattern = pattern << 1 | qt_is_leaf(children[i]);
+    }
+    return nfactory_make(factory, MLV_COLOR_GREY, children);
+}
+
+Color decode_qte_color(RangeDecoder *decoder, QteModel *model, int depth) {
+    Color color = model->previous;
+    int zero = 1, i;
+
+    model->repeated = rcoder_decode(decoder, &model->repeat[qte_context_depth(depth)][model->repeated]);
+    int red_change = 0;
+    for (i = 0; i < NB_CHANNELS && !model->repeated; i++)
+    {
+        int shift = 8 * (NB_CHANNELS - 1 - i);
+        int predicted = (model->previous >> shift) + (i == 1 || i == 2 ? red_change : 0);
+        int difference = unzigzag(rcoder_decode_byte(decoder, model->channels[i][zero]));
+        int channel = (predicted + difference) & 0xFF;
+        if(i == 0) red_change = channel - ((model->previous >> shift) & 0xFF);
+        color = (color & ~((Color) 0xFF << shift)) | (Color) channel << shift;
+        zero = difference == 0;
+    }
+
+    model->previous = color;
+    return color;
+}
+
+int qte_context_depth(int depth) {
+    return depth < QTE_DEPTHS ? depth : QTE_DEPTHS - 1;
+}
+
+/* Map a difference modulo 256 to 0, -1, 1, -2, ... so small differences of
+either sign share the first contexts of the byte. */
+int zigzag(int difference) {
+    return difference < 128 ? 2 * difference : 2 * (256 - difference) - 1;
+}
+
+int unzigzag(int value) {
+    return value % 2 == 0 ? value / 2 : 256 - (value + 1) / 2;
+}
+
+Quadtree load_qte(const char* filename, int *width, int *height, int hash_consing) {
+    Quadtree tree = NULL;
+    FILE *src = fopen(filename, "r");
+    if(src == NULL) {
+        printf("Couldn't read qte file\n");
+        return tree;
+    }
+
+    BitBuffer bit_buffer;
+    bbuf_open(&bit_buffer, src);
+
+    uint32_t magic = bbuf_read_color(&bit_buffer);
+    uint32_t file_width = bbuf_read_color(&bit_buffer);
+    uint32_t file_height = bbuf_read_color(&bit_buffer);
+    if(magic == QTE_MAGIC && !bbuf_past_end(&bit_buffer) &&
+        file_width > 0 && file_width <= QTE_MAX_SIDE && file_height > 0 && file_height <= QTE_MAX_SIDE) {
+        *width = file_width;
+        *height = file_height;
+
+        RangeDecoder decoder;
+        QteModel model;
+        init_qte_model(&model, *width, *height);
+        rcoder_decoder_init(&decoder, &bit_buffer);
+
+        NodeArena *arena = arena_create();
+        NodeFactory factory;
+        nfactory_init(&factory, arena, hash_consing);
+        tree = decode_qte_node(&decoder, &model, 0, 0, &factory);
+        nfactory_clear(factory);
+
+        if(tree == NULL || bbuf_past_end(&bit_buffer)) {
+            arena_release(arena);
+            tree = NULL;
+        } else {
+            arena->root = tree;
+        }
+    }
+    if(tree == NULL)
+        printf("Invalid qte file\n");
+
+    bbuf_clear(bit_buffer);
+    fclose(src);
+    return tree;
+}
+
+/* The bytes written by enc_save_to_qte, the tree being coded without being
+saved. */
+size_t qte_size(Quadtree tree, int width, int height) {
+    BitBuffer bit_buffer;
+
+    encode_qte(&bit_buffer, tree, width, height);
+    size_t size = bit_buffer.byte_pos;
+    bbuf_clear(bit_buffer);
+    return size;
+}
+
+/* Return the depth of the areas of one pixel, whose nodes are leaves. */
+int pixel_depth(int width, int height) {
+    int size = width > height ? width : height;
+    int depth = 0;
+
+    while(depth < 31 && (1 << depth) < size)
+        depth++;
+    return depth;
+}
+
+/**
+ * Save a quadtree to the specified filename with qtp format, the leaf colors
+ * being indexes in a palette. The palette holds the distinct leaf colors when
+ * there are at most max_colors of them, so the file keeps the tree without
+ * loss, and colors quantized by median cut otherwise.
+ * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param filename the filename of the saved quadtree.
+ * \param max_colors the largest size of the palette.
+ */
+void enc_save_to_qtp(Quadtree tree, int width, int height, const char* filename, size_t max_colors) {
+    BitBuffer bit_buffer;
+    Palette palette;
+    PaletteMap map;
+    size_t leaves, internal_nodes, i;
+
+    palette_build(&palette, &map, tree, width, height, max_colors);
+    int index_bits = palette_index_bits(palette.size);
+
+    qt_get_tree_infos(tree, &leaves, &internal_nodes);
+    bbuf_init(&bit_buffer, 4 * sizeof(uint32_t) + palette.size * sizeof(Color) +
+        (leaves * (index_bits + 1) + internal_nodes) / 8);
+    bbuf_add_color(&bit_buffer, QTP_MAGIC);
+    bbuf_add_color(&bit_buffer, width);
+    bbuf_add_color(&bit_buffer, height);
+    bbuf_add_color(&bit_buffer, palette.size);
+    for (i = 0; i < palette.size; i++)
+    {
+        bbuf_add_color(&bit_buffer, palette.colors[i]);
+    }
+    if(tree != NULL)
+        add_qtp_to_bit_buffer(&bit_buffer, tree, &map, index_bits);
+
+    palette_map_clear(map);
+    palette_clear(palette);
+    put_qt_bit_buffer(&bit_buffer, filename);
+}
+
+/* Adding the bits of a quadtree in pre-order, a leaf with the index of its
+color. */
+void add_qtp_to_bit_buffer(BitBuffer *b_buffer, Quadtree tree, PaletteMap *map, int index_bits) {
+    size_t i;
+
+    if(qt_is_leaf(tree)) {
+        bbuf_add_bits(b_buffer, (uint64_t) LEAF << index_bits | palette_map_index(map, tree->color), index_bits + 1);
+        return;
+    }
+
+    bbuf_add(b_buffer, NODE);
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        add_qtp_to_bit_buffer(b_buffer, tree->nodes[i], map, index_bits);
+    }
+}
+
+/**
+ * Load a quadtree from a specified file with the qtp format.
+ * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
+ * \return the loaded quadtree, NULL if the file is not a valid qtp file.
+ */
+Quadtree enc_load_qtp(const char* filename, int *width, int *height) {
+    return load_qtp(filename, width, height, 0);
+}
+
+Quadtree load_qtp(const char* filename, int *width, int *height, int hash_consing) {
+    IndexedQuadtree indexed;
+
+    if(!enc_load_indexed(filename, &indexed)) return NULL;
+
+    Quadtree tree = enc_indexed_to_quadtree(&indexed, hash_consing);
+    *width = indexed.width;
+    *height = indexed.height;
+    enc_indexed_clear(indexed);
+    return tree;
+}
+
+/**
+ * Load a qtp file keeping its indexed form: the nodes take a bit each and the
+ * leaves the bits of their index, without any pointer. The nodes are checked
+ * while being copied from the file. The indexed quadtree must be released
+ * using enc_indexed_clear.
+ * \param filename the filename containing the quadtree.
+ * \param indexed the indexed quadtree to be initialized.
+ * \return 1 if the file was loaded, 0 if it is not a valid qtp file.
+ */
+int enc_load_indexed(const char* filename, IndexedQuadtree *indexed) {
+    FILE *src = fopen(filename, "r");
+    if(src == NULL) {
+        printf("Couldn't read qtp file\n");
+        return 0;
+    }
+
+    BitBuffer bit_buffer;
+    size_t i;
+    int valid = 0;
+    bbuf_open(&bit_buffer, src);
+
+    if(bbuf_read_color(&bit_buffer) == QTP_MAGIC) {
+        indexed->width = bbuf_read_color(&bit_buffer);
+        indexed->height = bbuf_read_color(&bit_buffer);
+        indexed->palette.size = bbuf_read_color(&bit_buffer);
+        /* A color takes 4 bytes, which bounds the palette of a mapped file. */
+        valid = indexed->palette.size > 0 &&
+            (bit_buffer.stream != NULL || indexed->palette.size <= bit_buffer.size / sizeof(Color));
+    }
+
+    if(valid) {
+        indexed->palette.colors = malloc(indexed->palette.size * sizeof(Color));
+        if(indexed->palette.colors == NULL) {
+            printf("Error malloc Palette\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < indexed->palette.size; i++)
+        {
+            indexed->palette.colors[i] = bbuf_read_color(&bit_buffer);
+        }
+        indexed->index_bits = palette_index_bits(indexed->palette.size);
+
+        bbuf_init(&indexed->nodes, bit_buffer.size);
+        valid = copy_qtp_nodes(&bit_buffer, &indexed->nodes, indexed, 0,
+            pixel_depth(indexed->width, indexed->height));
+        bbuf_rewind(&indexed->nodes);
+        if(!valid)
+            enc_indexed_clear(*indexed);
+    }
+    if(!valid)
+        printf("Invalid qtp file\n");
+
+    bbuf_clear(bit_buffer);
+    fclose(src);
+    return valid;
+}
+
+/* Copying the nodes of a subtree from a file, returning 0 if the index of a
+leaf is out of the palette or if a node of one pixel is not a leaf. */
+int copy_qtp_nodes(BitBuffer *src, BitBuffer *dest, IndexedQuadtree *indexed, int depth, int max_depth) {
+    size_t i;
+
+    if(bbuf_read(src) == LEAF) {
+        uint64_t index = bbuf_read_bits(src, indexed->index_bits);
+        bbuf_add_bits(dest, (uint64_t) LEAF << indexed->index_bits | index, indexed->index_bits + 1);
+        return index < indexed->palette.size;
     }
 
+    if(depth >= max_depth) return 0;
+
+    bbuf_add(dest, NODE);
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        if(!copy_qtp_nodes(src, dest, indexed, depth + 1, max_depth)) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Release the specified indexed quadtree.
+ * \param indexed the indexed quadtree to be cleared.
+ */
+void enc_indexed_clear(IndexedQuadtree indexed) {
+    palette_clear(indexed.palette);
+    bbuf_clear(indexed.nodes);
+}
+
+/**
+ * Create the quadtree of an indexed quadtree, each leaf receiving its palette
+ * color. The tree must be freed using qt_free_minimized.
+ * \param indexed the indexed quadtree.
+ * \param hash_consing 1 to make each subtree once, as enc_load_shared does.
+ * \return the created quadtree.
+ */
+Quadtree enc_indexed_to_quadtree(IndexedQuadtree *indexed, int hash_consing) {
+    NodeArena *arena = arena_create();
+    NodeFactory factory;
+
+    nfactory_init(&factory, arena, hash_consing);
+    bbuf_seek(&indexed->nodes, 0);
+    Quadtree tree = create_quadtree_from_indexed(indexed, &factory);
+    nfactory_clear(factory);
+
+    arena->root = tree;
     return tree;
 }
 
+/* Creating the nodes of an indexed quadtree, the children before their
+parent. */
+Quadtree create_quadtree_from_indexed(IndexedQuadtree *indexed, NodeFactory *factory) {
+    if(bbuf_read(&indexed->nodes) == LEAF)
+        return nfactory_make(factory,
+            indexed->palette.colors[bbuf_read_bits(&indexed->nodes, indexed->index_bits)], NULL);
+
+    Quadtree children[QT_MAX_NODE];
+    size_t i;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        children[i] = create_quadtree_from_indexed(indexed, factory);
+    }
+    return nfactory_make(factory, MLV_COLOR_GREY, children);
+}
+
+/**
+ * Call a function on every leaf of an indexed quadtree, in pre-order, with
+ * the area it covers and its palette color.
+ * \param indexed the indexed quadtree to be traversed.
+ * \param visit the function called with each leaf.
+ * \param data the pointer passed to each call.
+ */
+void enc_indexed_for_each_leaf(IndexedQuadtree *indexed, void (*visit)(Area area, Color color, void *data), void *data) {
+    Area area = {0, 0, indexed->width, indexed->height};
+
+    bbuf_seek(&indexed->nodes, 0);
+    visit_indexed(indexed, area, visit, data);
+}
+
+void visit_indexed(IndexedQuadtree *indexed, Area area, void (*visit)(Area area, Color color, void *data), void *data) {
+    size_t i;
+
+    if(bbuf_read(&indexed->nodes) == LEAF) {
+        visit(area, indexed->palette.colors[bbuf_read_bits(&indexed->nodes, indexed->index_bits)], data);
+        return;
+    }
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        visit_indexed(indexed, get_sub_area(area, i), visit, data);
+    }
+}
+
+/**
+ * Return the memory taken by the nodes and the palette of an indexed
+ * quadtree.
+ * \param indexed the indexed quadtree.
+ * \return the size in bytes.
+ */
+size_t enc_indexed_memory(IndexedQuadtree *indexed) {
+    return indexed->nodes.size + indexed->palette.size * sizeof(Color);
+}
+
+/* The bytes written by enc_save_to_qtp, the palette being built without the
+tree being saved. */
+size_t qtp_size(Quadtree tree, int width, int height, size_t max_colors) {
+    Palette palette;
+    PaletteMap map;
+    size_t leaves, internal_nodes;
+
+    palette_build(&palette, &map, tree, width, height, max_colors);
+    int index_bits = palette_index_bits(palette.size);
+    size_t size = 4 * sizeof(uint32_t) + palette.size * sizeof(Color);
+    palette_map_clear(map);
+    palette_clear(palette);
+
+    qt_get_tree_infos(tree, &leaves, &internal_nodes);
+    return size + (leaves * (index_bits + 1) + internal_nodes + 7) / 8;
+}
+
 /**
  * Save a quadtree to the specified filename with gmn format.
  * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
  * \param filename the filename of the saved quadtree.
  */
-void enc_save_to_gmn(Quadtree tree, const char* filename) {
-    save_to_gm(tree, filename, BIT);
+void enc_save_to_gmn(Quadtree tree, int width, int height, const char* filename) {
+    save_to_gm(tree, width, height, filename, BIT);
 }
 
 /**
  * Save a quadtree to the specified filename with gmc format.
  * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
  * \param filename the filename of the saved quadtree.
  */
-void enc_save_to_gmc(Quadtree tree, const char* filename) {
-    save_to_gm(tree, filename, COLOR);
+void enc_save_to_gmc(Quadtree tree, int width, int height, const char* filename) {
+    save_to_gm(tree, width, height, filename, COLOR);
 }
 
-void save_to_gm(Quadtree tree, const char* filename, color_format color_format) {
-    FILE *dest = fopen(filename, "w");
-    if(dest == NULL) {
-        printf("Couldn't save quadtree to gmc\n");
-        exit(EXIT_FAILURE);
+/* The subtrees with the same leaves are written once, the colors of the
+internal nodes not being stored, so the file is minimized without loss even
+if the tree is not. The classes are numbered densely, children
+first, and each child is referenced by the distance back to its class as a
+varint. The root is the last node. */
+void save_to_gm(Quadtree tree, int width, int height, const char* filename, color_format color_format) {
+    BitBuffer bit_buffer;
+    SubtreeClasses classes;
+    size_t c;
+
+    minimize_classify_leaves(tree, &classes);
+    /* About 5 bytes for a leaf of color or a node, the buffer growing if needed. */
+    bbuf_init(&bit_buffer, 3 * sizeof(uint32_t) + 5 * classes.table.nb_entries);
+    bbuf_add_color(&bit_buffer, GM_MAGIC);
+    bbuf_add_color(&bit_buffer, width);
+    bbuf_add_color(&bit_buffer, height);
+    add_varint(&bit_buffer, classes.table.nb_entries);
+    for (c = 0; c < classes.table.nb_entries; c++)
+    {
+        add_gm_to_bit_buffer(&bit_buffer, c, &classes, color_format);
     }
-    qt_reset_visited_nodes(tree);
-    qt_set_id(tree);
-    qt_reset_visited_nodes(tree);
-    add_gm_to_file(tree, dest, color_format);
-    fclose(dest);
+    minimize_classes_clear(classes);
+
+    put_qt_bit_buffer(&bit_buffer, filename);
 }
 
-/* Adding character to a file based on the specified quadtree and color format. */
-void add_gm_to_file(Quadtree tree, FILE *file, color_format color_format) {
-    if(tree->visited) return;
-    tree->visited = 1;
+/* Adding the bits of a class of subtrees, its flag then its color or the
+references to its children. */
+void add_gm_to_bit_buffer(BitBuffer *b_buffer, size_t id, SubtreeClasses *classes, color_format color_format) {
+    Quadtree tree = classes->table.entries[id].tree;
+    size_t child, i;
 
-    if(!qt_is_leaf(tree)) {
-        fprintf(file, "%ld %ld %ld %ld %ld\n", tree->id,
-        tree->nodes[0]->id, tree->nodes[1]->id, tree->nodes[2]->id, tree->nodes[3]->id);
+    if(qt_is_leaf(tree)) {
+        add_leaf(b_buffer, tree->color, color_format);
+        return;
+    }
 
-        size_t i;
-        for (i = 0; i < QT_MAX_NODE; i++)
-        {
-            add_gm_to_file(tree->nodes[i], file, color_format);
-        }
-    } else {
-        if(color_format == BIT) {
-            fprintf(file, "%ld %d\n", tree->id, convert_to_bit_color(tree->color));
-        } else{
-            fprintf(file, "%ldf %d %d %d %d\n", tree->id, 
-            red(tree->color), 
-            green(tree->color), 
-            blue(tree->color), 
-            alpha(tree->color));
-        }
+    bbuf_add(b_buffer, NODE);
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        nmap_get(&classes->classes, tree->nodes[i], &child);
+        add_varint(b_buffer, id - child);
     }
 }
 
+/* Adding a value by groups of 7 bits, the lowest first, each one preceded by
+a bit telling whether another group follows. */
+void add_varint(BitBuffer *b_buffer, size_t value) {
+    while(value >= 0x80) {
+        bbuf_add_bits(b_buffer, 0x80 | (value & 0x7f), 8);
+        value >>= 7;
+    }
+    bbuf_add_bits(b_buffer, value, 8);
+}
+
+size_t read_varint(BitBuffer *b_buffer) {
+    size_t value = 0, group;
+    int shift = 0;
+
+    do {
+        group = bbuf_read_bits(b_buffer, 8);
+        if(shift < (int) (8 * sizeof(size_t)))
+            value |= (group & 0x7f) << shift;
+        shift += 7;
+    } while(group & 0x80);
+
+    return value;
+}
+
+/* The number of bits written by add_varint. */
+size_t varint_size(size_t value) {
+    size_t bits = 8;
+    while(value >= 0x80) {
+        value >>= 7;
+        bits += 8;
+    }
+    return bits;
+}
+
 /**
  * Load a quadtree from a specified file with the gmn format.
  * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
  * \return the loaded quadtree.
  */
-Quadtree enc_load_gmn(const char* filename) {
-    return load_gm(filename, BIT);
+Quadtree enc_load_gmn(const char* filename, int *width, int *height) {
+    return load_gm(filename, width, height, BIT, 0);
 }
 
 /**
  * Load a quadtree from a specified file with the gmc format.
  * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
  * \return the loaded quadtree.
  */
-Quadtree enc_load_gmc(const char* filename) {
-    return load_gm(filename, COLOR);
+Quadtree enc_load_gmc(const char* filename, int *width, int *height) {
+    return load_gm(filename, width, height, COLOR, 0);
 }
 
-Quadtree load_gm(const char* filename, color_format color_format) {
+/* A binary file is read through a bit buffer. Text files from earlier versions
+are told by their first byte, so they are still read from pipes. */
+Quadtree load_gm(const char* filename, int *width, int *height, color_format color_format, int hash_consing) {
     Quadtree tree = NULL;
     FILE *src = fopen(filename, "r");
     if(src == NULL) {
         printf("Couldn't read gm file\n");
         return tree;
     }
-    size_t nb_node = count_lines(filename);
-    tree = create_quadtree_from_gm(src, nb_node, color_format);
+
+    int first = fgetc(src);
+    ungetc(first, src);
+    if(first == (GM_MAGIC >> 24)) {
+        BitBuffer bit_buffer;
+        bbuf_open(&bit_buffer, src);
+        if(bbuf_read_color(&bit_buffer) == GM_MAGIC)
+            tree = create_quadtree_from_gm(&bit_buffer, width, height, color_format, hash_consing);
+        else
+            printf("Invalid gm file\n");
+        bbuf_clear(bit_buffer);
+    } else {
+        tree = create_quadtree_from_text_gm(src, width, height, color_format, hash_consing);
+    }
+
     fclose(src);
     return tree;
 }
 
-size_t count_lines(const char* filename) {
-    char c;
-    size_t lines;
-    FILE* file = fopen(filename, "r");
-    lines = 0;
-    while((c = fgetc(file)) != EOF) {
-        if(c == '\n') lines++;
+/* Creating a quadtree from a binary minimized graph file, in a single pass:
+the children of a node are made before it. Each node is allocated once, and
+a node referenced twice is shared. */
+Quadtree create_quadtree_from_gm(BitBuffer *b_buffer, int *width, int *height, color_format color_format,
+    int hash_consing) {
+    *width = bbuf_read_color(b_buffer);
+    *height = bbuf_read_color(b_buffer);
+    size_t nb_node = read_varint(b_buffer);
+    /* A node takes a bit at least, which bounds the count of a mapped file. */
+    if(nb_node == 0 || (b_buffer->stream == NULL && nb_node > b_buffer->size * 8)) {
+        printf("Invalid gm file\n");
+        return NULL;
     }
-    fclose(file);
-    return lines;
-}
 
-void parse_value_gmc(Quadtree *nodes, char* line) {
-    int value[5];
-    size_t nb_value, j;
-    
-    char * token = strtok(line, " ");
-    for(nb_value = 0; token != NULL; nb_value++) {
-        value[nb_value] = atoi(token);
-        token = strtok(NULL, " ");
+    Quadtree *nodes = malloc(nb_node * sizeof(Quadtree));
+    char *referenced = calloc(nb_node, 1);
+    if(nodes == NULL || referenced == NULL) {
+        printf("Error malloc gm nodes\n");
+        exit(EXIT_FAILURE);
     }
 
-    int id = value[0];
-    /* Tagging used nodes. */
-    nodes[id]->visited = 1;
-    
-    if(strchr(line, 'f') != NULL) {
-        nodes[id]->color = MLV_convert_rgba_to_color(value[1], value[2], value[3], value[4]);
-    } else {
+    NodeArena *arena = arena_create();
+    NodeFactory factory;
+    nfactory_init(&factory, arena, hash_consing);
+
+    size_t id, j;
+    for (id = 0; id < nb_node; id++)
+    {
+        if(bbuf_read(b_buffer) == LEAF) {
+            if(color_format == BIT)
+                nodes[id] = nfactory_make(&factory, bbuf_read(b_buffer) ? MLV_COLOR_WHITE : MLV_COLOR_BLACK, NULL);
+            else
+                nodes[id] = nfactory_make(&factory, bbuf_read_color(b_buffer), NULL);
+            continue;
+        }
+
+        Quadtree children[QT_MAX_NODE];
         for (j = 0; j < QT_MAX_NODE; j++)
         {
-            int node_id = value[j + 1];
-            nodes[id]->nodes[j] = nodes[node_id];
+            size_t distance = read_varint(b_buffer);
+            if(distance == 0 || distance > id) break;
+
+            size_t child = id - distance;
+            children[j] = nodes[child];
+            if(referenced[child])
+                children[j]->shared = 1;
+            referenced[child] = 1;
         }
+        if(j < QT_MAX_NODE) break;
+
+        /* The gm files hold the colors of the leaves only. */
+        nodes[id] = nfactory_make(&factory, 0, children);
+    }
+    nfactory_clear(factory);
+
+    Quadtree root = NULL;
+    if(id == nb_node) {
+        root = nodes[nb_node - 1];
+        arena->root = root;
+    } else {
+        printf("Invalid gm file\n");
+        arena_release(arena);
     }
+
+    free(referenced);
+    free(nodes);
+    return root;
 }
 
-void parse_value_gmn(Quadtree *nodes, char* line) {
-    int value[5];
-    size_t nb_value;
+/* Parsing the integers of a line, returning their number. */
+int parse_values(char *line, int value[5]) {
+    int nb_value;
 
     char * token = strtok(line, " ");
-    for(nb_value = 0; token != NULL; nb_value++) {
+    for(nb_value = 0; token != NULL && nb_value < 5; nb_value++) {
         value[nb_value] = atoi(token);
         token = strtok(NULL, " ");
     }
+    return nb_value;
+}
+
+/* Growing the lines so they hold the identification numbers of a line, the
+numbers of earlier versions not being dense. */
+GmLine *reserve_lines(GmLine *lines, size_t *size, int value[5], size_t nb_value) {
+    size_t needed = 0, i;
+
+    for (i = 0; i < nb_value; i++)
+    {
+        if(value[i] >= 0 && (size_t) value[i] >= needed)
+            needed = value[i] + 1;
+    }
+    if(needed <= *size) return lines;
+
+    size_t old_size = *size;
+    while(*size < needed) *size *= 2;
+    lines = realloc(lines, *size * sizeof(GmLine));
+    if(lines == NULL) {
+        printf("Error malloc gm nodes\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = old_size; i < *size; i++)
+    {
+        lines[i].color = 0;
+        lines[i].is_leaf = 1;
+    }
+    return lines;
+}
+
+void parse_value_gmc(GmLine **lines, size_t *size, char* line) {
+    int value[5];
+    int nb_value = parse_values(line, value);
+    if(nb_value == 0 || value[0] < 0) return;
+
+    int id = value[0];
+
+    if(strchr(line, 'f') != NULL) {
+        *lines = reserve_lines(*lines, size, value, 1);
+        (*lines)[id].color = MLV_convert_rgba_to_color(value[1], value[2], value[3], value[4]);
+    } else if(nb_value == 5) {
+        *lines = reserve_lines(*lines, size, value, nb_value);
+        (*lines)[id].is_leaf = 0;
+        memcpy((*lines)[id].children, value + 1, sizeof((*lines)[id].children));
+    }
+}
+
+void parse_value_gmn(GmLine **lines, size_t *size, char* line) {
+    int value[5];
+    int nb_value = parse_values(line, value);
+    if(nb_value == 0 || value[0] < 0) return;
 
     int id = value[0];
-    /* Tagging used nodes. */
-    nodes[id]->visited = 1;
-    size_t j;
+    *lines = reserve_lines(*lines, size, value, nb_value);
 
     if(nb_value == 5) {
-        for (j = 0; j < QT_MAX_NODE; j++)
-        {
-            int node_id = value[j + 1];
-            nodes[id]->nodes[j] = nodes[node_id];
-        }
+        (*lines)[id].is_leaf = 0;
+        memcpy((*lines)[id].children, value + 1, sizeof((*lines)[id].children));
     } else {
-        nodes[id]->color = value[1] ? MLV_COLOR_WHITE : MLV_COLOR_BLACK;
+        (*lines)[id].color = value[1] ? MLV_COLOR_WHITE : MLV_COLOR_BLACK;
     }
 }
 
-/* Creating a quadtree from a minimized graph file file. */
-Quadtree create_quadtree_from_gm(FILE* file, size_t nb_node, color_format color_format) {
-    /* When minimizing some nodes are freed. Thus the identification number is 
-    not linear. We need a bigger buffer for indexing quadtree. */
-    size_t size = nb_node;
-    Quadtree nodes[size];
-    Quadtree root = NULL;
+/* Making the node of an identification number, its children first. A node
+referenced twice is shared, which its parents record for the cached
+aggregates. */
+Quadtree make_gm_node(GmLine *lines, Quadtree *nodes, char *referenced, int id, NodeFactory *factory) {
+    if(nodes[id] != NULL) return nodes[id];
+
+    if(lines[id].is_leaf) {
+        nodes[id] = nfactory_make(factory, lines[id].color, NULL);
+        return nodes[id];
+    }
+
+    Quadtree children[QT_MAX_NODE];
+    size_t j;
+    for (j = 0; j < QT_MAX_NODE; j++)
+    {
+        int node_id = lines[id].children[j];
+        children[j] = make_gm_node(lines, nodes, referenced, node_id, factory);
+        if(referenced[node_id])
+            children[j]->shared = 1;
+        referenced[node_id] = 1;
+    }
+
+    nodes[id] = nfactory_make(factory, lines[id].color, children);
+    return nodes[id];
+}
+
+/* Creating a quadtree from a text minimized graph file of earlier versions. */
+Quadtree create_quadtree_from_text_gm(FILE* file, int *width, int *height, color_format color_format,
+    int hash_consing) {
+    size_t size = GM_LINES;
+    GmLine *lines = malloc(size * sizeof(GmLine));
+    if(lines == NULL) {
+        printf("Error malloc gm nodes\n");
+        exit(EXIT_FAILURE);
+    }
 
     /* Reading line variables. */
     char * line = NULL;
     size_t len = 0;
-    
+
     size_t i;
     for (i = 0; i < size; i++)
     {
-        nodes[i] = qt_create_node(0);
+        lines[i].color = 0;
+        lines[i].is_leaf = 1;
     }
-    root = nodes[0];
+
+    *width = LEGACY_IMG_SIZE;
+    *height = LEGACY_IMG_SIZE;
 
     /* Reading the line, then split it and parse it into integer. */
     while(getline(&line, &len, file) != EOF) {
-        if(color_format == BIT)
-            parse_value_gmn(nodes, line);
+        if(strncmp(line, GM_HEADER, strlen(GM_HEADER)) == 0)
+            sscanf(line + strlen(GM_HEADER), "%d %d", width, height);
+        else if(color_format == BIT)
+            parse_value_gmn(&lines, &size, line);
         else
-            parse_value_gmc(nodes, line);
+            parse_value_gmc(&lines, &size, line);
     }
     free(line);
 
-    /* Removing unused nodes. */
+    Quadtree *nodes = malloc(size * sizeof(Quadtree));
+    char *referenced = calloc(size, 1);
+    if(nodes == NULL || referenced == NULL) {
+        printf("Error malloc gm nodes\n");
+        exit(EXIT_FAILURE);
+    }
     for (i = 0; i < size; i++)
     {
-        if(!nodes[i]->visited)
-            free(nodes[i]);
+        nodes[i] = NULL;
     }
 
+    /* The nodes not reached from the root are not made. */
+    NodeArena *arena = arena_create();
+    NodeFactory factory;
+    nfactory_init(&factory, arena, hash_consing);
+    Quadtree root = make_gm_node(lines, nodes, referenced, 0, &factory);
+    nfactory_clear(factory);
+
+    free(referenced);
+    free(nodes);
+    free(lines);
+
+    arena->root = root;
     return root; 
 }
 
@@ -349,25 +1229,50 @@ Quadtree create_quadtree_from_gm(FILE* file, size_t nb_node, color_format color_
  * Load a quadtree from a specified file. The format of the file determine 
  * how it should be loaded. Return NULL if the file extension is not valid.
  * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
+ * \return the loaded quadtree.
+ */
+Quadtree enc_load(const char* filename, int *width, int *height) {
+    return load(filename, width, height, 0);
+}
+
+/**
+ * Load a quadtree from a specified file as enc_load does, each subtree being
+ * made once: identical subtrees are the same nodes, without the whole tree
+ * being built first. The tree must be freed using qt_free_minimized.
+ * \param filename the filename containing the quadtree.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
  * \return the loaded quadtree.
  */
-Quadtree enc_load(const char* filename) {
+Quadtree enc_load_shared(const char* filename, int *width, int *height) {
+    return load(filename, width, height, 1);
+}
+
+Quadtree load(const char* filename, int *width, int *height, int hash_consing) {
     Quadtree tree = NULL;
 
     char* ext = strchr(filename, '.') + 1;
     if(ext == NULL + 1) return tree;
 
     if(strcmp(ext, "qtn") == 0) {
-        tree = enc_load_qtn(filename);
+        tree = load_qt(filename, width, height, BIT, hash_consing);
     }
     else if(strcmp(ext, "qtc") == 0) {
-        tree = enc_load_qtc(filename);
+        tree = load_qt(filename, width, height, COLOR, hash_consing);
+    }
+    else if(strcmp(ext, "qte") == 0) {
+        tree = load_qte(filename, width, height, hash_consing);
+    }
+    else if(strcmp(ext, "qtp") == 0) {
+        tree = load_qtp(filename, width, height, hash_consing);
     }
     else if(strcmp(ext, "gmn") == 0) {
-        tree = enc_load_gmn(filename);
+        tree = load_gm(filename, width, height, BIT, hash_consing);
     }
     else if(strcmp(ext, "gmc") == 0) {
-        tree = enc_load_gmc(filename);
+        tree = load_gm(filename, width, height, COLOR, hash_consing);
     }
 
     return tree;
@@ -377,10 +1282,12 @@ Quadtree enc_load(const char* filename) {
  * Save a quadtree to the specified filename. Check the file
  * extension and returns 0 if it is invalid.
  * \param tree the quadtree to be saved.
+ * \param width the width of the image.
+ * \param height the height of the image.
  * \param filename the filename of the saved quadtree.
  * \return 0 if the file extension is invalid.
  */
-int enc_save(Quadtree tree, const char* filename) {
+int enc_save(Quadtree tree, int width, int height, const char* filename) {
     char* ext = strchr(filename, '.') + 1;
     if(ext == NULL + 1) {
         printf("invalid filename\n");
@@ -388,17 +1295,133 @@ int enc_save(Quadtree tree, const char* filename) {
     }
 
     if(strcmp(ext, "qtn") == 0) {
-        enc_save_to_qtn(tree, filename);
+        enc_save_to_qtn(tree, width, height, filename);
     }
     else if(strcmp(ext, "qtc") == 0) {
-        enc_save_to_qtc(tree, filename);
+        enc_save_to_qtc(tree, width, height, filename);
+    }
+    else if(strcmp(ext, "qte") == 0) {
+        enc_save_to_qte(tree, width, height, filename);
+    }
+    else if(strcmp(ext, "qtp") == 0) {
+        enc_save_to_qtp(tree, width, height, filename, QTP_COLORS);
     }
     else if(strcmp(ext, "gmn") == 0) {
-        enc_save_to_gmn(tree, filename);
+        enc_save_to_gmn(tree, width, height, filename);
     }
     else if(strcmp(ext, "gmc") == 0) {
-        enc_save_to_gmc(tree, filename);
+        enc_save_to_gmc(tree, width, height, filename);
     }
 
     return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * Return the size of the file a quadtree would be saved to, without writing
+ * it. Check the file extension as enc_save does.
+ * \param tree the quadtree to be measured.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param filename the filename the quadtree would be saved to.
+ * \return the size of the file in bytes, 0 if the file extension is invalid.
+ */
+size_t enc_size(Quadtree tree, int width, int height, const char* filename) {
+    char* ext = strchr(filename, '.') + 1;
+    if(ext == NULL + 1) return 0;
+
+    if(strcmp(ext, "qtn") == 0) {
+        return qt_size(tree, BIT);
+    }
+    else if(strcmp(ext, "qtc") == 0) {
+        return qt_size(tree, COLOR);
+    }
+    else if(strcmp(ext, "qte") == 0) {
+        return qte_size(tree, width, height);
+    }
+    else if(strcmp(ext, "qtp") == 0) {
+        return qtp_size(tree, width, height, QTP_COLORS);
+    }
+    else if(strcmp(ext, "gmn") == 0) {
+        return gm_size(tree, BIT);
+    }
+    else if(strcmp(ext, "gmc") == 0) {
+        return gm_size(tree, COLOR);
+    }
+
+    return 0;
+}
+
+/**
+ * Return the size of the file a tree with the specified number of nodes
+ * would be saved to, for the formats whose size only depends on it: qtn
+ * and qtc. Check the file extension as enc_save does.
+ * \param leaves the number of leaves of the tree.
+ * \param internal_nodes the number of internal nodes of the tree.
+ * \param filename the filename the tree would be saved to.
+ * \return the size of the file in bytes, 0 if the file extension is invalid
+ * or its size also depends on the colors or the shared subtrees of the tree.
+ */
+size_t enc_nodes_size(size_t leaves, size_t internal_nodes, const char* filename) {
+    char* ext = strchr(filename, '.') + 1;
+    if(ext == NULL + 1) return 0;
+
+    if(strcmp(ext, "qtn") == 0) {
+        return qt_layout_size(leaves, internal_nodes, BIT);
+    }
+    else if(strcmp(ext, "qtc") == 0) {
+        return qt_layout_size(leaves, internal_nodes, COLOR);
+    }
+
+    return 0;
+}
+
+/* The size of the qtn or qtc file of a tree. */
+size_t qt_size(Quadtree tree, color_format color_format) {
+    size_t leaves, internal_nodes;
+
+    qt_get_tree_infos(tree, &leaves, &internal_nodes);
+    return qt_layout_size(leaves, internal_nodes, color_format);
+}
+
+/* The bits written by add_qt_to_bit_buffer, after the header and padded to
+a byte. */
+size_t qt_layout_size(size_t leaves, size_t internal_nodes, color_format color_format) {
+    size_t bits;
+
+    if(color_format == BIT)
+        bits = 2 * leaves + internal_nodes;
+    else
+        bits = 33 * leaves + internal_nodes;
+
+    return 3 * sizeof(uint32_t) + (bits + 7) / 8;
+}
+
+/* The bits written by save_to_gm, padded to a byte. */
+size_t gm_size(Quadtree tree, color_format color_format) {
+    size_t bits, c, i, child;
+    SubtreeClasses classes;
+
+    minimize_classify_leaves(tree, &classes);
+    bits = 3 * 32 + varint_size(classes.table.nb_entries);
+    for (c = 0; c < classes.table.nb_entries; c++)
+    {
+        Quadtree node = classes.table.entries[c].tree;
+
+        if(!qt_is_leaf(node)) {
+            bits += 1;
+            for (i = 0; i < QT_MAX_NODE; i++)
+            {
+                nmap_get(&classes.classes, node->nodes[i], &child);
+                bits += varint_size(c - child);
+            }
+        } else if(color_format == BIT) {
+            bits += 2;
+        } else {
+            bits += 33;
+        }
+    }
+    minimize_classes_clear(classes);
+
+    return (bits + 7) / 8;
+}
+
@@ -28,6 +28,9 @@ MLV_Button_state was_pressed = MLV_RELEASED;
 /* Informations about the current image. */
 char status_message[255];
 
+/* Copy of the current image scaled down to fit the drawing area. */
+MLV_Image *preview_img = NULL;
+
 const char * gui_icons[] = {
     "res/gui/open.png",
     "res/gui/save.png",
@@ -137,23 +140,39 @@ void change_status_message(const char* message) {
     strcpy(status_message, message);
 }
 
-void open_button_action(Quadtree* tree, MLV_Image **img) {
+/* Replace the preview by a scaled down copy of the specified image. */
+void update_preview(MLV_Image *img) {
+    if(preview_img != NULL) MLV_free_image(preview_img);
+    preview_img = NULL;
+    if(img == NULL) return;
+
+    int width, height, fit_width, fit_height;
+    MLV_get_image_size(img, &width, &height);
+    draw_fit_size(width, height, IMG_SIZE, &fit_width, &fit_height);
+
+    preview_img = MLV_copy_image(img);
+    MLV_resize_image(preview_img, fit_width, fit_height);
+}
+
+void open_button_action(Quadtree* tree, MLV_Image **img, int *width, int *height) {
     if(*tree != NULL) qt_free_minimized(*tree);
+    if(*img != NULL) MLV_free_image(*img);
     *tree = NULL;
     *img = NULL;
 
     char* filename;
     filename = gui_create_input_box();
-    *tree = enc_load(filename);
+    *tree = enc_load(filename, width, height);
 
     if(*tree != NULL) {
         qt_reset_color(*tree);
         printf("tree loaded\n");
     } else {
         *img = MLV_load_image(filename);
-        if(*img != NULL) MLV_resize_image(*img, IMG_SIZE, IMG_SIZE);
+        if(*img != NULL) MLV_get_image_size(*img, width, height);
         printf("img loaded\n");
     }
+    update_preview(*img);
 
     if(*img == NULL && *tree == NULL) {
         printf("the file does not exist or is not valid\n");
@@ -164,7 +183,7 @@ void open_button_action(Quadtree* tree, MLV_Image **img) {
     free(filename);
 }
 
-void save_button_action(Quadtree* tree) {
+void save_button_action(Quadtree* tree, int width, int height) {
     if(*tree == NULL) {
         printf("this image is not valid\n");
         return;
@@ -172,7 +191,7 @@ void save_button_action(Quadtree* tree) {
 
     char* filename;
     filename = gui_create_input_box();
-    if(enc_save(*tree, filename) == 0) {
+    if(enc_save(*tree, width, height, filename) == 0) {
         printf("invalid filename\n");
     }
     else {
@@ -188,8 +207,14 @@ void tree_button_action(Quadtree *tree, MLV_Image **img) {
     }
 
     printf("beginning tree approximation...\n");
-    *tree = qt_create_quadtree(*img);
+    Bitmap bitmap;
+    convert_img_to_bitmap(*img, &bitmap);
+    *tree = qt_create_quadtree(&bitmap);
+    bitmap_clear(bitmap);
+
+    MLV_free_image(*img);
     *img = NULL;
+    update_preview(NULL);
     printf("...done\n");
 }
 
@@ -217,6 +242,8 @@ void gui_start() {
     Button toolbar[8];
     Quadtree current_tree = NULL;
     MLV_Image *current_img = NULL;
+    int current_width = 0, current_height = 0;
+    int fit_width, fit_height;
     draw_style style = STANDARD;
 
     change_status_message("no file selected");
@@ -234,20 +261,22 @@ void gui_start() {
         MLV_actualise_window();
         MLV_clear_window(BACKGROUND_COLOR);
         
-        if(current_img != NULL) {
-            MLV_draw_image(current_img, WINDOW_WIDTH/2 - IMG_SIZE/2, TOOL_BAR_HEIGHT);
+        draw_fit_size(current_width, current_height, IMG_SIZE, &fit_width, &fit_height);
+        if(preview_img != NULL) {
+            MLV_draw_image(preview_img, WINDOW_WIDTH/2 - fit_width/2, TOOL_BAR_HEIGHT);
         } else if(current_tree != NULL) {
-            draw_quadtree_image(WINDOW_WIDTH/2 - IMG_SIZE/2, TOOL_BAR_HEIGHT, current_tree, style);
+            draw_quadtree_image(WINDOW_WIDTH/2 - fit_width/2, TOOL_BAR_HEIGHT, current_tree, 
+            fit_width, fit_height, style);
         }        
 
         gui_display_tool_bar(toolbar);
         gui_display_status_bar(status_message);
 
         if(gui_is_pressed(toolbar[OPEN])) {
-            open_button_action(&current_tree, &current_img);
+            open_button_action(&current_tree, &current_img, &current_width, &current_height);
         }
         if(gui_is_pressed(toolbar[SAVE])) {
-            save_button_action(&current_tree);
+            save_button_action(&current_tree, current_width, current_height);
         }
         if(gui_is_pressed(toolbar[TREE])) {
             tree_button_action(&current_tree, &current_img);
@@ -273,5 +302,6 @@ void gui_start() {
         qt_free_minimized(current_tree);
     if(current_img != NULL)
         MLV_free_image(current_img);
+    update_preview(NULL);
     MLV_free_window();
 }
\ No newline at end of file
@@ -0,0 +1,362 @@
+/*
+Headless ingestion of images into bitmaps. Pixels are converted row by row
+from raw buffers, without any MLV call.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/ingest.h"
+
+/* Number of rows read from a file before being converted. */
+#define ROWS_PER_READ 64
+
+/* Maximum length of a PAM header line. */
+#define PAM_LINE_SIZE 256
+
+static void convert_rows(Color *dest, const unsigned char *src, int width, int rows,
+    size_t stride, int channels, int maxval);
+static int read_header_value(FILE *src);
+static int read_pam_header(FILE *src, int *width, int *height, int *channels, int *maxval);
+static int read_raster(FILE *src, Bitmap *bitmap, int width, int height, int channels, int maxval);
+static FILE *open_netpbm(const char *filename, int accept_ppm, int accept_pam,
+    int *width, int *height, int *channels, int *maxval);
+static int load_netpbm(const char *filename, Bitmap *bitmap, int accept_ppm, int accept_pam);
+
+/**
+ * Fill a bitmap from a raw pixel buffer. The bitmap is initialized with the
+ * buffer dimensions and must be released using bitmap_clear.
+ * \param bitmap the bitmap to receive the pixels.
+ * \param pixels the raw pixels, one byte per sample, row by row.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param stride the number of bytes between the start of two rows.
+ * \param format the layout of the samples of a pixel.
+ */
+void ingest_from_buffer(Bitmap *bitmap, const unsigned char *pixels, int width, int height,
+    size_t stride, pixel_format format)
+{
+    bitmap_init(bitmap, width, height);
+    /* Formats are ordered by their number of samples. */
+    convert_rows(bitmap->pixels, pixels, width, height, stride, format + 1, 255);
+}
+
+/**
+ * Load a binary PPM or PGM file (P6 or P5) into a bitmap.
+ * \param filename the file to be loaded.
+ * \param bitmap the bitmap to receive the image, released using bitmap_clear.
+ * \return 1 if the image was loaded, 0 otherwise.
+ */
+int ingest_load_ppm(const char *filename, Bitmap *bitmap)
+{
+    return load_netpbm(filename, bitmap, 1, 0);
+}
+
+/**
+ * Load a PAM file (P7) with a depth from 1 to 4 into a bitmap.
+ * \param filename the file to be loaded.
+ * \param bitmap the bitmap to receive the image, released using bitmap_clear.
+ * \return 1 if the image was loaded, 0 otherwise.
+ */
+int ingest_load_pam(const char *filename, Bitmap *bitmap)
+{
+    return load_netpbm(filename, bitmap, 0, 1);
+}
+
+/**
+ * Load any image file supported by the ingestion layer into a bitmap. The
+ * format is recognized from the content of the file.
+ * \param filename the file to be loaded.
+ * \param bitmap the bitmap to receive the image, released using bitmap_clear.
+ * \return 1 if the image was loaded, 0 if it is not supported or invalid.
+ */
+int ingest_load(const char *filename, Bitmap *bitmap)
+{
+    return load_netpbm(filename, bitmap, 1, 1);
+}
+
+/**
+ * Open a netpbm file to read areas of its raster with ingest_read_area. The
+ * stream must be closed using ingest_close.
+ * \param filename the file to be opened.
+ * \param stream the stream to be initialized.
+ * \return 1 if the file was opened, 0 if it is not supported or invalid.
+ */
+int ingest_open(const char *filename, ImageStream *stream)
+{
+    stream->file = open_netpbm(filename, 1, 1, &stream->width, &stream->height,
+        &stream->channels, &stream->maxval);
+    if (stream->file == NULL)
+        return 0;
+
+    stream->raster = ftell(stream->file);
+    return 1;
+}
+
+/**
+ * Read an area of the image of a stream into a bitmap, seeking to each row
+ * of the area. Only the area is held in memory.
+ * \param stream the stream to read from.
+ * \param area the area to be read, inside the image.
+ * \param bitmap the bitmap to receive the area, released using bitmap_clear.
+ * \return 1 if the area was read, 0 otherwise.
+ */
+int ingest_read_area(ImageStream *stream, Area area, Bitmap *bitmap)
+{
+    size_t pixel_size = (size_t) stream->channels * (stream->maxval > 255 ? 2 : 1);
+    size_t stride = area.width * pixel_size;
+    unsigned char *row = malloc(stride > 0 ? stride : 1);
+    int y;
+
+    if (row == NULL)
+    {
+        printf("Error malloc ingestion buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bitmap_init(bitmap, area.width, area.height);
+
+    for (y = 0; y < area.height && area.width > 0; y++)
+    {
+        long offset = stream->raster +
+            (long) (((size_t) (area.y + y) * stream->width + area.x) * pixel_size);
+
+        if (fseek(stream->file, offset, SEEK_SET) != 0 ||
+            fread(row, stride, 1, stream->file) != 1)
+        {
+            free(row);
+            bitmap_clear(*bitmap);
+            return 0;
+        }
+        convert_rows(bitmap->pixels + (size_t) y * area.width, row, area.width, 1,
+            stride, stream->channels, stream->maxval);
+    }
+
+    free(row);
+    return 1;
+}
+
+/**
+ * Close a stream opened with ingest_open.
+ * \param stream the stream to be closed.
+ */
+void ingest_close(ImageStream *stream)
+{
+    fclose(stream->file);
+}
+
+int load_netpbm(const char *filename, Bitmap *bitmap, int accept_ppm, int accept_pam)
+{
+    int width, height, channels, maxval;
+
+    FILE *src = open_netpbm(filename, accept_ppm, accept_pam, &width, &height, &channels, &maxval);
+    if (src == NULL)
+        return 0;
+
+    if (!read_raster(src, bitmap, width, height, channels, maxval))
+    {
+        printf("Couldn't read the pixels of %s\n", filename);
+        fclose(src);
+        return 0;
+    }
+
+    fclose(src);
+    return 1;
+}
+
+/* Open a netpbm file and read its header, leaving the file at the first
+pixel. Return NULL if the file is not supported or invalid. */
+FILE *open_netpbm(const char *filename, int accept_ppm, int accept_pam,
+    int *width, int *height, int *channels, int *maxval)
+{
+    char magic[2];
+
+    FILE *src = fopen(filename, "rb");
+    if (src == NULL)
+        return NULL;
+
+    if (fread(magic, 1, 2, src) != 2 || magic[0] != 'P')
+    {
+        fclose(src);
+        return NULL;
+    }
+
+    if (accept_ppm && (magic[1] == '5' || magic[1] == '6'))
+    {
+        *channels = magic[1] == '6' ? 3 : 1;
+        *width = read_header_value(src);
+        *height = read_header_value(src);
+        *maxval = read_header_value(src);
+    }
+    else if (accept_pam && magic[1] == '7')
+    {
+        if (!read_pam_header(src, width, height, channels, maxval))
+            *width = -1;
+    }
+    else
+    {
+        fclose(src);
+        return NULL;
+    }
+
+    if (*width <= 0 || *height <= 0 || *maxval <= 0 || *maxval > 65535 ||
+        *channels < 1 || *channels > 4)
+    {
+        printf("Invalid netpbm header in %s\n", filename);
+        fclose(src);
+        return NULL;
+    }
+
+    return src;
+}
+
+/* Read a decimal header value, skipping whitespaces and comments. The single
+whitespace ending the value is consumed. Return -1 if there is none. */
+int read_header_value(FILE *src)
+{
+    int c, value;
+
+    c = fgetc(src);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '#')
+    {
+        if (c == '#')
+        {
+            while (c != '\n' && c != EOF)
+                c = fgetc(src);
+        }
+        c = fgetc(src);
+    }
+
+    if (c < '0' || c > '9')
+        return -1;
+
+    for (value = 0; c >= '0' && c <= '9'; c = fgetc(src))
+    {
+        if (value > 100000000)
+            return -1;
+        value = value * 10 + c - '0';
+    }
+    return value;
+}
+
+/* Read the header lines of a PAM file up to ENDHDR. */
+int read_pam_header(FILE *src, int *width, int *height, int *channels, int *maxval)
+{
+    char line[PAM_LINE_SIZE];
+    char key[PAM_LINE_SIZE];
+    int value;
+
+    *width = *height = *channels = *maxval = -1;
+
+    while (fgets(line, PAM_LINE_SIZE, src) != NULL)
+    {
+        if (line[0] == '#' || sscanf(line, "%255s", key) != 1)
+            continue;
+        if (strcmp(key, "ENDHDR") == 0)
+            return 1;
+        if (strcmp(key, "TUPLTYPE") == 0 || sscanf(line, "%*s %d", &value) != 1)
+            continue;
+
+        if (strcmp(key, "WIDTH") == 0)
+            *width = value;
+        else if (strcmp(key, "HEIGHT") == 0)
+            *height = value;
+        else if (strcmp(key, "DEPTH") == 0)
+            *channels = value;
+        else if (strcmp(key, "MAXVAL") == 0)
+            *maxval = value;
+    }
+
+    return 0;
+}
+
+/* Read the pixels of a netpbm file, ROWS_PER_READ rows at a time. */
+int read_raster(FILE *src, Bitmap *bitmap, int width, int height, int channels, int maxval)
+{
+    size_t stride = (size_t) width * channels * (maxval > 255 ? 2 : 1);
+    unsigned char *rows = malloc(stride * ROWS_PER_READ);
+    int y, nb_rows;
+
+    if (rows == NULL)
+    {
+        printf("Error malloc ingestion buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bitmap_init(bitmap, width, height);
+
+    for (y = 0; y < height; y += nb_rows)
+    {
+        nb_rows = height - y < ROWS_PER_READ ? height - y : ROWS_PER_READ;
+        if (fread(rows, stride, nb_rows, src) != (size_t) nb_rows)
+        {
+            free(rows);
+            bitmap_clear(*bitmap);
+            return 0;
+        }
+        convert_rows(bitmap->pixels + (size_t) y * width, rows, width, nb_rows,
+            stride, channels, maxval);
+    }
+
+    free(rows);
+    return 1;
+}
+
+/* Convert rows of samples to colors. Samples are one byte, or two big-endian
+bytes when maxval exceeds 255. Gray samples are copied to every channel, and
+the alpha channel is opaque unless the number of channels is even. */
+void convert_rows(Color *dest, const unsigned char *src, int width, int rows,
+    size_t stride, int channels, int maxval)
+{
+    int sample_size = maxval > 255 ? 2 : 1;
+    int x, y, k;
+
+    for (y = 0; y < rows; y++)
+    {
+        const unsigned char *s = src + y * stride;
+        Color *d = dest + (size_t) y * width;
+
+        if (maxval == 255 && channels == 3)
+        {
+            for (x = 0; x < width; x++, s += 3)
+            {
+                d[x] = ((Color) s[0] << 24) | ((Color) s[1] << 16) | ((Color) s[2] << 8) | 0xff;
+            }
+        }
+        else if (maxval == 255 && channels == 4)
+        {
+            for (x = 0; x < width; x++, s += 4)
+            {
+                d[x] = ((Color) s[0] << 24) | ((Color) s[1] << 16) | ((Color) s[2] << 8) | s[3];
+            }
+        }
+        else
+        {
+            for (x = 0; x < width; x++)
+            {
+                unsigned long samples[4];
+
+                for (k = 0; k < channels; k++, s += sample_size)
+                {
+                    samples[k] = sample_size == 2 ? (s[0] << 8) | s[1] : s[0];
+                    if (maxval != 255)
+                        samples[k] = (samples[k] * 255 + maxval / 2) / maxval;
+                }
+
+                if (channels <= 2)
+                {
+                    samples[ALPHA] = channels == 2 ? samples[1] : 255;
+                    samples[RED] = samples[GREEN] = samples[BLUE] = samples[0];
+                }
+                else if (channels == 3)
+                {
+                    samples[ALPHA] = 255;
+                }
+
+                d[x] = (Color) (samples[RED] << 24 | samples[GREEN] << 16 |
+                    samples[BLUE] << 8 | samples[ALPHA]);
+            }
+        }
+    }
+}
@@ -0,0 +1,394 @@
+/*
+Kernels over rows of packed pixels. The vectorized versions split the bytes
+of 4 or 8 pixels into their channels in registers, so the bitmaps keep their
+packed layout. The best implementation supported by the processor is
+selected at runtime, with a scalar fallback on every platform.
+*/
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/* Number of pixels of a row summed with 32 bits integers, whose squares
+can't overflow them. */
+#define ROW_SUMS_RUN 32768
+
+/* Pixels of the row, and passes over it, timed to choose between the SSE2
+and AVX2 kernels. */
+#define CALIBRATION_WIDTH 1024
+#define CALIBRATION_PASSES 16
+
+/* Add the channel sums of a row of pixels. */
+typedef void (*row_sums_kernel)(const Color *row, int width, ChannelSums *sums);
+
+/* Fill a row of summed-area tables from the row above. */
+typedef void (*row_prefix_kernel)(const Color *row, int width, const ChannelSums *above, ChannelSums *cells);
+
+static void select_kernels(void);
+static void set_kernels(kernel_set kernel);
+static clock_t time_kernels(kernel_set kernel);
+static void row_sums_scalar(const Color *row, int width, ChannelSums *sums);
+static void row_prefix_scalar(const Color *row, int width, const ChannelSums *above, ChannelSums *cells);
+
+#ifdef KERNELS_X86
+static void add_lanes(uint32_t sum[4], uint32_t square[4], ChannelSums *sums);
+static void row_sums_sse2(const Color *row, int width, ChannelSums *sums);
+static void row_prefix_sse2(const Color *row, int width, const ChannelSums *above, ChannelSums *cells);
+static void row_sums_avx2(const Color *row, int width, ChannelSums *sums);
+static void row_prefix_avx2(const Color *row, int width, const ChannelSums *above, ChannelSums *cells);
+#endif
+
+static pthread_once_t selection = PTHREAD_ONCE_INIT;
+static row_sums_kernel row_sums = row_sums_scalar;
+static row_prefix_kernel row_prefix = row_prefix_scalar;
+static kernel_set current_kernel = KERNEL_SCALAR;
+
+/**
+ * Add the channel sums of a row of pixels to the specified sums. The first
+ * call selects the fastest supported kernels.
+ * \param row the first pixel of the row.
+ * \param width the number of pixels of the row.
+ * \param sums the channel sums receiving the pixels.
+ */
+void kernel_row_sums(const Color *row, int width, ChannelSums *sums)
+{
+    pthread_once(&selection, select_kernels);
+    row_sums(row, width, sums);
+}
+
+/**
+ * Fill a row of summed-area tables: each cell receives the cell above it
+ * plus the channel sums of the pixels of the row up to its own.
+ * \param row the first pixel of the row.
+ * \param width the number of pixels of the row.
+ * \param above the cells of the row above.
+ * \param cells the cells to be filled.
+ */
+void kernel_row_prefix(const Color *row, int width, const ChannelSums *above, ChannelSums *cells)
+{
+    pthread_once(&selection, select_kernels);
+    row_prefix(row, width, above, cells);
+}
+
+/**
+ * Return 1 if the processor supports the specified kernels.
+ * \param kernel the kernels to be checked.
+ * \return 1 if the kernels can be used.
+ */
+int kernel_supported(kernel_set kernel)
+{
+    switch (kernel)
+    {
+    case KERNEL_SCALAR:
+        return 1;
+#ifdef KERNELS_X86
+    case KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Select the kernels used from now on, in place of the fastest ones.
+ * \param kernel the kernels to be used.
+ * \return 0 if the processor does not support them.
+ */
+int kernel_use(kernel_set kernel)
+{
+    pthread_once(&selection, select_kernels);
+    if (!kernel_supported(kernel))
+        return 0;
+
+    set_kernels(kernel);
+    return 1;
+}
+
+/**
+ * Return the kernels currently used.
+ */
+kernel_set kernel_current(void)
+{
+    pthread_once(&selection, select_kernels);
+    return current_kernel;
+}
+
+/**
+ * Return the name of the specified kernels.
+ */
+const char *kernel_name(kernel_set kernel)
+{
+    return kernel == KERNEL_AVX2 ? "avx2" : kernel == KERNEL_SSE2 ? "sse2" : "scalar";
+}
+
+/* Use the fastest supported kernels. AVX2 is not faster than SSE2 on every
+processor, so both are timed when they are supported. */
+void select_kernels(void)
+{
+    kernel_set kernel = KERNEL_SCALAR;
+
+    if (kernel_supported(KERNEL_SSE2))
+        kernel = KERNEL_SSE2;
+    if (kernel_supported(KERNEL_AVX2) &&
+        (kernel == KERNEL_SCALAR || time_kernels(KERNEL_AVX2) < time_kernels(KERNEL_SSE2)))
+        kernel = KERNEL_AVX2;
+
+    set_kernels(kernel);
+}
+
+/* Return the processor time of a few passes of the specified kernels over
+a row, after a pass loading it in the cache. */
+clock_t time_kernels(kernel_set kernel)
+{
+    static Color row[CALIBRATION_WIDTH];
+    static ChannelSums above[CALIBRATION_WIDTH], cells[CALIBRATION_WIDTH];
+    ChannelSums sums;
+    clock_t start = 0;
+    int x, pass;
+
+    for (x = 0; x < CALIBRATION_WIDTH; x++)
+    {
+        row[x] = (Color) x * 2654435761u;
+    }
+
+    set_kernels(kernel);
+    for (pass = 0; pass <= CALIBRATION_PASSES; pass++)
+    {
+        if (pass == 1)
+            start = clock();
+        memset(&sums, 0, sizeof(ChannelSums));
+        row_sums(row, CALIBRATION_WIDTH, &sums);
+        row_prefix(row, CALIBRATION_WIDTH, above, cells);
+    }
+
+    return clock() - start;
+}
+
+/* Point the kernels to the specified implementation. */
+void set_kernels(kernel_set kernel)
+{
+    row_sums = row_sums_scalar;
+    row_prefix = row_prefix_scalar;
+#ifdef KERNELS_X86
+    if (kernel == KERNEL_SSE2)
+    {
+        row_sums = row_sums_sse2;
+        row_prefix = row_prefix_sse2;
+    }
+    else if (kernel == KERNEL_AVX2)
+    {
+        row_sums = row_sums_avx2;
+        row_prefix = row_prefix_avx2;
+    }
+#endif
+    current_kernel = kernel;
+}
+
+/* The channels are read as get_channel_value does, and summed with 32 bits
+integers over runs of pixels. */
+void row_sums_scalar(const Color *row, int width, ChannelSums *sums)
+{
+    int x, end;
+
+    for (x = 0; x < width; x = end)
+    {
+        uint32_t r = 0, g = 0, b = 0, a = 0, rr = 0, gg = 0, bb = 0, aa = 0;
+        end = width - x > ROW_SUMS_RUN ? x + ROW_SUMS_RUN : width;
+        for (; x < end; x++)
+        {
+            uint32_t red = row[x] >> 24, green = (row[x] >> 16) & 0xff;
+            uint32_t blue = (row[x] >> 8) & 0xff, alpha = row[x] & 0xff;
+            r += red;
+            g += green;
+            b += blue;
+            a += alpha;
+            rr += red * red;
+            gg += green * green;
+            bb += blue * blue;
+            aa += alpha * alpha;
+        }
+        sums->sum[RED] += r;
+        sums->sum[GREEN] += g;
+        sums->sum[BLUE] += b;
+        sums->sum[ALPHA] += a;
+        sums->square[RED] += rr;
+        sums->square[GREEN] += gg;
+        sums->square[BLUE] += bb;
+        sums->square[ALPHA] += aa;
+    }
+}
+
+void row_prefix_scalar(const Color *row, int width, const ChannelSums *above, ChannelSums *cells)
+{
+    uint64_t sum[4] = {0, 0, 0, 0}, square[4] = {0, 0, 0, 0};
+    uint64_t channels[4];
+    int x, k;
+
+    for (x = 0; x < width; x++)
+    {
+        channels[RED] = row[x] >> 24;
+        channels[GREEN] = (row[x] >> 16) & 0xff;
+        channels[BLUE] = (row[x] >> 8) & 0xff;
+        channels[ALPHA] = row[x] & 0xff;
+
+        for (k = 0; k < 4; k++)
+        {
+            sum[k] += channels[k];
+            square[k] += channels[k] * channels[k];
+            cells[x].sum[k] = above[x].sum[k] + sum[k];
+            cells[x].square[k] = above[x].square[k] + square[k];
+        }
+    }
+}
+
+#ifdef KERNELS_X86
+
+/* Add lanes holding the bytes of the pixels, from the lowest one: alpha,
+blue, green and red. */
+void add_lanes(uint32_t sum[4], uint32_t square[4], ChannelSums *sums)
+{
+    sums->sum[ALPHA] += sum[0];
+    sums->sum[BLUE] += sum[1];
+    sums->sum[GREEN] += sum[2];
+    sums->sum[RED] += sum[3];
+    sums->square[ALPHA] += square[0];
+    sums->square[BLUE] += square[1];
+    sums->square[GREEN] += square[2];
+    sums->square[RED] += square[3];
+}
+
+/* Four pixels at once: the 16 bits channels of two pixels are interleaved
+so that one multiply-add gives the sum, or the sum of squares, of each
+channel. */
+__attribute__((target("sse2")))
+void row_sums_sse2(const Color *row, int width, ChannelSums *sums)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i ones = _mm_set1_epi16(1);
+    uint32_t sum_lanes[4], square_lanes[4];
+    int x = 0, end;
+
+    while (x + 4 <= width)
+    {
+        __m128i sum = zero, square = zero;
+        end = width - x > ROW_SUMS_RUN ? x + ROW_SUMS_RUN : width;
+        for (; x + 4 <= end; x += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i *) (row + x));
+            __m128i low = _mm_unpacklo_epi8(pixels, zero);
+            __m128i high = _mm_unpackhi_epi8(pixels, zero);
+            __m128i even = _mm_unpacklo_epi16(low, high);
+            __m128i odd = _mm_unpackhi_epi16(low, high);
+
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(even, ones), _mm_madd_epi16(odd, ones)));
+            square = _mm_add_epi32(square, _mm_add_epi32(_mm_madd_epi16(even, even), _mm_madd_epi16(odd, odd)));
+        }
+        _mm_storeu_si128((__m128i *) sum_lanes, sum);
+        _mm_storeu_si128((__m128i *) square_lanes, square);
+        add_lanes(sum_lanes, square_lanes, sums);
+    }
+
+    row_sums_scalar(row + x, width - x, sums);
+}
+
+/* The channels of a pixel are widened to 64 bits, red first as in the
+cells, so two of them are added at once. */
+__attribute__((target("sse2")))
+void row_prefix_sse2(const Color *row, int width, const ChannelSums *above, ChannelSums *cells)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum_red_green = zero, sum_blue_alpha = zero;
+    __m128i square_red_green = zero, square_blue_alpha = zero;
+    int x;
+
+    for (x = 0; x < width; x++)
+    {
+        const __m128i *up = (const __m128i *) &above[x];
+        __m128i *cell = (__m128i *) &cells[x];
+        __m128i pixel = _mm_unpacklo_epi8(_mm_cvtsi32_si128(row[x]), zero);
+        __m128i channels = _mm_unpacklo_epi16(_mm_shufflelo_epi16(pixel, _MM_SHUFFLE(0, 1, 2, 3)), zero);
+        __m128i red_green = _mm_unpacklo_epi32(channels, zero);
+        __m128i blue_alpha = _mm_unpackhi_epi32(channels, zero);
+
+        sum_red_green = _mm_add_epi64(sum_red_green, red_green);
+        sum_blue_alpha = _mm_add_epi64(sum_blue_alpha, blue_alpha);
+        square_red_green = _mm_add_epi64(square_red_green, _mm_mul_epu32(red_green, red_green));
+        square_blue_alpha = _mm_add_epi64(square_blue_alpha, _mm_mul_epu32(blue_alpha, blue_alpha));
+
+        _mm_storeu_si128(cell, _mm_add_epi64(_mm_loadu_si128(up), sum_red_green));
+        _mm_storeu_si128(cell + 1, _mm_add_epi64(_mm_loadu_si128(up + 1), sum_blue_alpha));
+        _mm_storeu_si128(cell + 2, _mm_add_epi64(_mm_loadu_si128(up + 2), square_red_green));
+        _mm_storeu_si128(cell + 3, _mm_add_epi64(_mm_loadu_si128(up + 3), square_blue_alpha));
+    }
+}
+
+/* Eight pixels at once, as row_sums_sse2 does in each half of the
+registers. */
+__attribute__((target("avx2")))
+void row_sums_avx2(const Color *row, int width, ChannelSums *sums)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ones = _mm256_set1_epi16(1);
+    uint32_t sum_lanes[4], square_lanes[4];
+    int x = 0, end;
+
+    while (x + 8 <= width)
+    {
+        __m256i sum = zero, square = zero;
+        end = width - x > ROW_SUMS_RUN ? x + ROW_SUMS_RUN : width;
+        for (; x + 8 <= end; x += 8)
+        {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *) (row + x));
+            __m256i low = _mm256_unpacklo_epi8(pixels, zero);
+            __m256i high = _mm256_unpackhi_epi8(pixels, zero);
+            __m256i even = _mm256_unpacklo_epi16(low, high);
+            __m256i odd = _mm256_unpackhi_epi16(low, high);
+
+            sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_madd_epi16(even, ones),
+                _mm256_madd_epi16(odd, ones)));
+            square = _mm256_add_epi32(square, _mm256_add_epi32(_mm256_madd_epi16(even, even),
+                _mm256_madd_epi16(odd, odd)));
+        }
+        _mm_storeu_si128((__m128i *) sum_lanes,
+            _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+        _mm_storeu_si128((__m128i *) square_lanes,
+            _mm_add_epi32(_mm256_castsi256_si128(square), _mm256_extracti128_si256(square, 1)));
+        add_lanes(sum_lanes, square_lanes, sums);
+    }
+
+    row_sums_scalar(row + x, width - x, sums);
+}
+
+/* The four channels of a pixel are widened to 64 bits in one register,
+red first once its bytes are swapped. */
+__attribute__((target("avx2")))
+void row_prefix_avx2(const Color *row, int width, const ChannelSums *above, ChannelSums *cells)
+{
+    __m256i sum = _mm256_setzero_si256(), square = _mm256_setzero_si256();
+    int x;
+
+    for (x = 0; x < width; x++)
+    {
+        const __m256i *up = (const __m256i *) &above[x];
+        __m256i *cell = (__m256i *) &cells[x];
+        __m256i channels = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(__builtin_bswap32(row[x])));
+
+        sum = _mm256_add_epi64(sum, channels);
+        square = _mm256_add_epi64(square, _mm256_mul_epu32(channels, channels));
+
+        _mm256_storeu_si256(cell, _mm256_add_epi64(_mm256_loadu_si256(up), sum));
+        _mm256_storeu_si256(cell + 1, _mm256_add_epi64(_mm256_loadu_si256(up + 1), square));
+    }
+}
+
+#endif
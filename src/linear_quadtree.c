@@ -0,0 +1,272 @@
+/*
+Linear quadtree: the leaves of a quadtree stored in an array sorted by
+Morton code. Children are visited in Z-order (north-west, north-east,
+south-west, south-east), so a depth-first walk appends the leaves already
+sorted.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/linear_quadtree.h"
+
+/* Digit of each Direction in the codes. */
+static const int direction_digit[QT_MAX_NODE] = {0, 1, 3, 2};
+
+/* Direction of each digit of the codes. */
+static const Direction digit_direction[QT_MAX_NODE] = {NORTH_WEST, NORTH_EAST, SOUTH_WEST, SOUTH_EAST};
+
+static void lqt_add(LinearQuadtree *lqt, uint64_t code, int depth, Color color);
+static void collect_leaves(LinearQuadtree *lqt, Quadtree tree, uint64_t code, int depth);
+static Quadtree build_quadtree(LinearQuadtree *lqt, size_t *index, int depth, NodeArena *arena);
+static void walk_preorder(LinearQuadtree *lqt, size_t low, size_t high, uint64_t prefix, int depth,
+    void (*visit)(int is_leaf, Color color, void *data), void *data);
+static size_t lower_bound(LinearQuadtree *lqt, size_t low, size_t high, uint64_t code);
+
+/* Position of the digit of a level in the codes, the root being level 0. */
+#define DIGIT_SHIFT(level) (64 - 2 * (level))
+
+/**
+ * Initialize an empty linear quadtree. It must be released using lqt_clear.
+ * \param lqt the linear quadtree to be initialized.
+ */
+void lqt_init(LinearQuadtree *lqt)
+{
+    lqt->size = 0;
+    lqt->capacity = 0;
+    lqt->leaves = NULL;
+}
+
+/**
+ * Release the leaves of the specified linear quadtree.
+ * \param lqt the linear quadtree to be cleared.
+ */
+void lqt_clear(LinearQuadtree lqt)
+{
+    free(lqt.leaves);
+}
+
+/**
+ * Fill a linear quadtree with the leaves of a quadtree. Shared nodes of a
+ * minimized quadtree are expanded.
+ * \param lqt the initialized linear quadtree to be filled.
+ * \param tree the quadtree to be converted.
+ */
+void lqt_from_quadtree(LinearQuadtree *lqt, Quadtree tree)
+{
+    lqt->size = 0;
+    if (tree != NULL)
+        collect_leaves(lqt, tree, 0, 0);
+}
+
+void collect_leaves(LinearQuadtree *lqt, Quadtree tree, uint64_t code, int depth)
+{
+    if (qt_is_leaf(tree))
+    {
+        lqt_add(lqt, code, depth, tree->color);
+        return;
+    }
+
+    if (depth == LQT_MAX_DEPTH)
+    {
+        printf("Quadtree too deep for a linear quadtree\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t digit;
+    for (digit = 0; digit < QT_MAX_NODE; digit++)
+    {
+        collect_leaves(lqt, tree->nodes[digit_direction[digit]],
+            code | digit << DIGIT_SHIFT(depth + 1), depth + 1);
+    }
+}
+
+void lqt_add(LinearQuadtree *lqt, uint64_t code, int depth, Color color)
+{
+    if (lqt->size == lqt->capacity)
+    {
+        lqt->capacity = lqt->capacity == 0 ? 64 : lqt->capacity * 2;
+        lqt->leaves = realloc(lqt->leaves, lqt->capacity * sizeof(LinearLeaf));
+        if (lqt->leaves == NULL)
+        {
+            printf("Error malloc LinearQuadtree\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    lqt->leaves[lqt->size].code = code;
+    lqt->leaves[lqt->size].depth = depth;
+    lqt->leaves[lqt->size].color = color;
+    lqt->size++;
+}
+
+/**
+ * Create the pointer quadtree of a linear quadtree. The color of the
+ * internal nodes is the average of their children. The nodes are allocated
+ * in an arena owned by the tree.
+ * \param lqt the linear quadtree to be converted.
+ * \return the created quadtree, or NULL if the linear quadtree is empty.
+ */
+Quadtree lqt_to_quadtree(LinearQuadtree *lqt)
+{
+    size_t index = 0;
+    NodeArena *arena;
+    Quadtree tree;
+
+    if (lqt->size == 0)
+        return NULL;
+
+    arena = arena_create();
+    tree = build_quadtree(lqt, &index, 0, arena);
+    qt_reset_color(tree);
+    qt_cache_aggregates(tree);
+
+    arena->root = tree;
+    return tree;
+}
+
+/* The leaves are consumed in order, as the children are built in Z-order. */
+Quadtree build_quadtree(LinearQuadtree *lqt, size_t *index, int depth, NodeArena *arena)
+{
+    LinearLeaf *leaf = &lqt->leaves[*index];
+
+    if (leaf->depth == depth)
+    {
+        (*index)++;
+        return qt_create_arena_node(arena, leaf->color);
+    }
+
+    Quadtree tree = qt_create_arena_node(arena, 0);
+    size_t digit;
+    for (digit = 0; digit < QT_MAX_NODE; digit++)
+    {
+        tree->nodes[digit_direction[digit]] = build_quadtree(lqt, index, depth + 1, arena);
+    }
+    return tree;
+}
+
+/**
+ * Call a function on every leaf of a linear quadtree, in Z-order, with the
+ * area the leaf covers.
+ * \param lqt the linear quadtree to be traversed.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param visit the function called with the area and color of each leaf.
+ * \param data the pointer passed to each call.
+ */
+void lqt_for_each_leaf(LinearQuadtree *lqt, int width, int height,
+    void (*visit)(Area area, Color color, void *data), void *data)
+{
+    size_t i;
+    int level;
+
+    for (i = 0; i < lqt->size; i++)
+    {
+        LinearLeaf *leaf = &lqt->leaves[i];
+        Area area = {0, 0, width, height};
+
+        for (level = 1; level <= leaf->depth; level++)
+        {
+            area = get_sub_area(area, digit_direction[(leaf->code >> DIGIT_SHIFT(level)) & 3]);
+        }
+        visit(area, leaf->color, data);
+    }
+}
+
+/**
+ * Call a function on every node of a linear quadtree, in the depth-first
+ * order of the pointer quadtree used by the qtc and qtn formats. Internal
+ * nodes are rebuilt on the fly from the codes and have no color.
+ * \param lqt the linear quadtree to be traversed.
+ * \param visit the function called with each node, and its color for leaves.
+ * \param data the pointer passed to each call.
+ */
+void lqt_preorder(LinearQuadtree *lqt, void (*visit)(int is_leaf, Color color, void *data), void *data)
+{
+    if (lqt->size > 0)
+        walk_preorder(lqt, 0, lqt->size, 0, 0, visit, data);
+}
+
+/* The leaves of the node with the specified prefix are in [low, high). */
+void walk_preorder(LinearQuadtree *lqt, size_t low, size_t high, uint64_t prefix, int depth,
+    void (*visit)(int is_leaf, Color color, void *data), void *data)
+{
+    if (lqt->leaves[low].depth == depth)
+    {
+        visit(1, lqt->leaves[low].color, data);
+        return;
+    }
+    visit(0, 0, data);
+
+    size_t bounds[QT_MAX_NODE + 1];
+    uint64_t digit;
+    bounds[0] = low;
+    bounds[QT_MAX_NODE] = high;
+    for (digit = 1; digit < QT_MAX_NODE; digit++)
+    {
+        bounds[digit] = lower_bound(lqt, bounds[digit - 1], high, prefix | digit << DIGIT_SHIFT(depth + 1));
+    }
+
+    size_t i;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        digit = direction_digit[i];
+        walk_preorder(lqt, bounds[digit], bounds[digit + 1], prefix | digit << DIGIT_SHIFT(depth + 1),
+            depth + 1, visit, data);
+    }
+}
+
+/* Return the first index in [low, high) whose code is not lower than code. */
+size_t lower_bound(LinearQuadtree *lqt, size_t low, size_t high, uint64_t code)
+{
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (lqt->leaves[middle].code < code)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Find the leaf covering a pixel with a binary search on the codes.
+ * \param lqt the linear quadtree to search from.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param x the 'x' of the pixel.
+ * \param y the 'y' of the pixel.
+ * \return the index of the leaf, or -1 if the pixel is outside the image.
+ */
+long lqt_find(LinearQuadtree *lqt, int width, int height, int x, int y)
+{
+    Area area = {0, 0, width, height};
+    uint64_t code = 0;
+    int level;
+
+    if (lqt->size == 0 || x < 0 || y < 0 || x >= width || y >= height)
+        return -1;
+
+    /* The code of the pixel, whose leaf is the last one not greater. */
+    for (level = 1; level <= LQT_MAX_DEPTH && area.width * area.height > 1; level++)
+    {
+        uint64_t digit;
+        for (digit = 0; digit < QT_MAX_NODE; digit++)
+        {
+            Area sub_area = get_sub_area(area, digit_direction[digit]);
+            if (x >= sub_area.x && x < sub_area.x + sub_area.width &&
+                y >= sub_area.y && y < sub_area.y + sub_area.height)
+            {
+                area = sub_area;
+                code |= digit << DIGIT_SHIFT(level);
+                break;
+            }
+        }
+    }
+
+    size_t index = lower_bound(lqt, 0, lqt->size, code);
+    if (index == lqt->size || lqt->leaves[index].code != code)
+        index--;
+    return index;
+}
@@ -4,12 +4,33 @@
 #include "../include/encode.h"
 #include "../include/draw.h"
 #include "../include/gui.h"
+#include "../include/ingest.h"
+#include "../include/budget.h"
+#include "../include/kernels.h"
+#include "../include/linear_quadtree.h"
+#include "../include/tiled.h"
+#include "../include/rate.h"
 
+#include <string.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <time.h>
 
-void test_minimize(char* filename) {
-    MLV_create_window("", "", IMG_SIZE, IMG_SIZE);
+/* Number of passes in the benchmarks. */
+#define BENCH_ROUNDS 20
+
+/* Side of the tiles whose summed-area tables are loaded by the kernel
+benchmark, as large as the builders load. */
+#define TILE_SIDE 256
+
+/* Number of areas changed by the update test. */
+#define UPDATE_ROUNDS 48
+
+/* Load the specified image file at its native resolution. Netpbm files are
+read without MLV. */
+void load_bitmap(char* filename, Bitmap *bitmap) {
+    if(ingest_load(filename, bitmap)) return;
+
     MLV_Image *img = MLV_load_image(filename);
 
     if(img == NULL) {
@@ -17,30 +38,42 @@ void test_minimize(char* filename) {
         exit(EXIT_FAILURE);
     }
 
-    MLV_resize_image(img, IMG_SIZE, IMG_SIZE);
-    Quadtree qt = qt_create_quadtree(img);
+    convert_img_to_bitmap(img, bitmap);
+    MLV_free_image(img);
+}
+
+/* Draw a quadtree scaled down to the test window. */
+void draw_fitted(Quadtree qt, int width, int height) {
+    int fit_width, fit_height;
+    draw_fit_size(width, height, IMG_SIZE, &fit_width, &fit_height);
+    draw_quadtree_image(0, 0, qt, fit_width, fit_height, STANDARD);
+}
+
+void test_minimize(char* filename) {
+    MLV_create_window("", "", IMG_SIZE, IMG_SIZE);
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+
+    Quadtree qt = qt_create_quadtree(&bitmap);
 
-    draw_quadtree_image(0, 0, qt, STANDARD);
+    draw_fitted(qt, bitmap.width, bitmap.height);
     MLV_actualise_window();
 
-    qt_reset_visited_nodes(qt);
     printf("before : %d nodes\n", qt_count_node(qt));
-    qt_reset_visited_nodes(qt);
 
     printf("minimizing...\n");
     minimize_loss(qt, DISTANCE_RATE);
     printf("done...\n"); 
 
-    qt_reset_visited_nodes(qt);
     printf("after : %d nodes\n", qt_count_node(qt));
 
-    draw_quadtree_image(0, 0, qt, STANDARD);
+    draw_fitted(qt, bitmap.width, bitmap.height);
     MLV_actualise_window();
     MLV_wait_milliseconds(2000);
 
     qt_free_minimized(qt);
     MLV_free_window();
-    MLV_free_image(img);
+    bitmap_clear(bitmap);
 }
 
 void measure_minimize(char* filename) {
@@ -55,23 +88,640 @@ void measure_minimize(char* filename) {
     printf("elapsed time : %lf\n", cpu_time_used);
 }
 
+/* Return the wall-clock time in seconds. */
+double wall_time() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void measure_build(char* filename) {
+    MLV_create_window("", "", IMG_SIZE, IMG_SIZE);
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+
+    double start, serial_time, parallel_time;
+
+    start = wall_time();
+    Quadtree serial = qt_create_quadtree(&bitmap);
+    serial_time = wall_time() - start;
+
+    start = wall_time();
+    Quadtree parallel = qt_create_quadtree_parallel(&bitmap, 0);
+    parallel_time = wall_time() - start;
+
+    printf("serial : %lf s\n", serial_time);
+    printf("parallel : %lf s\n", parallel_time);
+    printf("speedup : %.2lf\n", serial_time / parallel_time);
+    printf("identical trees : %s\n", qt_equals(serial, parallel) ? "yes" : "no");
+
+    start = wall_time();
+    qt_free(serial);
+    printf("release : %lf s\n", wall_time() - start);
+    qt_free(parallel);
+    bitmap_clear(bitmap);
+    MLV_free_window();
+}
+
+/* Load the summed-area tables of each tile of an image, as the builders do,
+and add up the sums of the tiles. */
+void load_tiles(RegionStats *stats, Bitmap *bitmap, ChannelSums *total) {
+    Area tile;
+    ChannelSums sums;
+    size_t k;
+
+    memset(total, 0, sizeof(ChannelSums));
+    for (tile.y = 0; tile.y < bitmap->height; tile.y += TILE_SIDE)
+    {
+        for (tile.x = 0; tile.x < bitmap->width; tile.x += TILE_SIDE)
+        {
+            tile.width = bitmap->width - tile.x < TILE_SIDE ? bitmap->width - tile.x : TILE_SIDE;
+            tile.height = bitmap->height - tile.y < TILE_SIDE ? bitmap->height - tile.y : TILE_SIDE;
+            region_stats_load(stats, bitmap, tile);
+            region_sums(stats, tile, &sums);
+            for (k = 0; k < 4; k++)
+            {
+                total->sum[k] += sums.sum[k];
+                total->square[k] += sums.square[k];
+            }
+        }
+    }
+}
+
+/* Measure the channel sums of the whole image, read by the budgeted builder,
+and the summed-area tables of its tiles, read by the other builders, with
+each supported kernel. */
+void bench_kernels(char* filename) {
+    Bitmap bitmap;
+    RegionStats stats;
+    load_bitmap(filename, &bitmap);
+    region_stats_init(&stats);
+
+    Area area = {0, 0, bitmap.width, bitmap.height};
+    double pixels = (double) BENCH_ROUNDS * area.width * area.height;
+    kernel_set best = kernel_current();
+    ChannelSums reference, sums, table_sums;
+    double start, sums_time, tables_time;
+    size_t i;
+    int kernel;
+
+    for (kernel = KERNEL_SCALAR; kernel <= KERNEL_AVX2; kernel++)
+    {
+        if(!kernel_use(kernel)) continue;
+
+        start = wall_time();
+        for (i = 0; i < BENCH_ROUNDS; i++)
+        {
+            bitmap_area_sums(&bitmap, area, &sums);
+        }
+        sums_time = wall_time() - start;
+
+        start = wall_time();
+        for (i = 0; i < BENCH_ROUNDS; i++)
+        {
+            load_tiles(&stats, &bitmap, &table_sums);
+        }
+        tables_time = wall_time() - start;
+
+        if(kernel == KERNEL_SCALAR)
+            reference = sums;
+        printf("%s : sums %.1lf Mpixels/s, tables %.1lf Mpixels/s, %s\n", kernel_name(kernel),
+            pixels / sums_time / 1e6, pixels / tables_time / 1e6,
+            memcmp(&sums, &reference, sizeof(ChannelSums)) == 0 &&
+            memcmp(&table_sums, &reference, sizeof(ChannelSums)) == 0 ? "same sums" : "different sums");
+    }
+    printf("selected : %s\n", kernel_name(best));
+    kernel_use(best);
+
+    region_stats_clear(stats);
+    bitmap_clear(bitmap);
+}
+
+/* Measure the throughput of the qtn and qtc files of an image, saving then
+loading each one BENCH_ROUNDS times. */
+void bench_bit_buffer(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree qt = qt_create_quadtree_bottom_up(&bitmap, 0);
+
+    char *files[2] = {"img/bench.qtn", "img/bench.qtc"};
+    double start, save_time, load_time, megabytes;
+    int width, height;
+    size_t i, j;
+
+    for (i = 0; i < 2; i++)
+    {
+        start = wall_time();
+        for (j = 0; j < BENCH_ROUNDS; j++)
+        {
+            enc_save(qt, bitmap.width, bitmap.height, files[i]);
+        }
+        save_time = wall_time() - start;
+
+        Quadtree loaded = NULL;
+        start = wall_time();
+        for (j = 0; j < BENCH_ROUNDS; j++)
+        {
+            qt_free(loaded);
+            loaded = enc_load(files[i], &width, &height);
+        }
+        load_time = wall_time() - start;
+
+        megabytes = (double) BENCH_ROUNDS * enc_size(qt, bitmap.width, bitmap.height, files[i]) / 1e6;
+        printf("%s : save %.1lf MB/s, load %.1lf MB/s\n", files[i] + 4,
+            megabytes / save_time, megabytes / load_time);
+        qt_free(loaded);
+    }
+
+    qt_free(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Return 1 if two linear quadtrees hold the same leaves. */
+int lqt_same_leaves(LinearQuadtree *a, LinearQuadtree *b) {
+    size_t i;
+    if(a->size != b->size) return 0;
+    for (i = 0; i < a->size; i++)
+    {
+        if(a->leaves[i].code != b->leaves[i].code || a->leaves[i].depth != b->leaves[i].depth ||
+            a->leaves[i].color != b->leaves[i].color)
+            return 0;
+    }
+    return 1;
+}
+
+/* Check the linear quadtree of an image against its pointer quadtree: round
+trip, pixel lookups and qtc files written by both representations. */
+void test_linear(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree qt = qt_create_quadtree_bottom_up(&bitmap, 0);
+
+    LinearQuadtree lqt, reloaded;
+    lqt_init(&lqt);
+    lqt_init(&reloaded);
+    lqt_from_quadtree(&lqt, qt);
+
+    size_t leaves, internal_nodes;
+    qt_get_infos(qt, &leaves, &internal_nodes);
+    printf("pointer quadtree : %lu bytes\n", (unsigned long) ((leaves + internal_nodes) * sizeof(Node)));
+    printf("linear quadtree : %lu bytes\n", (unsigned long) (lqt.size * sizeof(LinearLeaf)));
+
+    Quadtree rebuilt = lqt_to_quadtree(&lqt);
+    lqt_from_quadtree(&reloaded, rebuilt);
+    printf("round trip : %s\n", lqt_same_leaves(&lqt, &reloaded) ? "ok" : "failed");
+
+    int x, y, lookups = 1;
+    for (y = 0; y < bitmap.height; y++)
+    {
+        for (x = 0; x < bitmap.width; x++)
+        {
+            long index = lqt_find(&lqt, bitmap.width, bitmap.height, x, y);
+            if(index < 0 || lqt.leaves[index].color != BITMAP_PIXEL(&bitmap, x, y))
+                lookups = 0;
+        }
+    }
+    printf("lookups : %s\n", lookups ? "ok" : "failed");
+
+    int width, height;
+    enc_save_linear_to_qtc(&lqt, bitmap.width, bitmap.height, "img/linear.qtc");
+    Quadtree loaded = enc_load_qtc("img/linear.qtc", &width, &height);
+    lqt_from_quadtree(&reloaded, loaded);
+    printf("qtc : %s\n", lqt_same_leaves(&lqt, &reloaded) && width == bitmap.width &&
+        height == bitmap.height ? "ok" : "failed");
+
+    qt_free(loaded);
+    qt_free(rebuilt);
+    qt_free(qt);
+    lqt_clear(reloaded);
+    lqt_clear(lqt);
+    bitmap_clear(bitmap);
+}
+
+/* Minimize an image without loss, serially then in parallel, and check the
+results against a fresh tree, then the gmc file written from the tree which
+is not minimized. */
+void test_lossless(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree qt = qt_create_quadtree_bottom_up(&bitmap, 0);
+    Quadtree reference = qt_create_quadtree_bottom_up(&bitmap, 0);
+
+    printf("before : %d nodes\n", qt_count_node(qt));
+    double start = wall_time();
+    minimize_lossless(qt);
+    printf("lossless : %lf s\n", wall_time() - start);
+    printf("after : %d nodes\n", qt_count_node(qt));
+    printf("identical trees : %s\n", qt_equals(qt, reference) ? "yes" : "no");
+
+    Quadtree parallel = qt_create_quadtree_bottom_up(&bitmap, 0);
+    start = wall_time();
+    minimize_lossless_parallel(parallel, 0);
+    printf("parallel : %lf s, %d nodes, %s\n", wall_time() - start, qt_count_node(parallel),
+        qt_equals(parallel, reference) ? "identical trees" : "different trees");
+    qt_free_minimized(parallel);
+
+    /* The gm files hold the colors of the leaves only. */
+    int width, height;
+    LinearQuadtree expected, reloaded;
+    lqt_init(&expected);
+    lqt_init(&reloaded);
+    enc_save_to_gmc(reference, bitmap.width, bitmap.height, "img/lossless.gmc");
+    Quadtree loaded = enc_load_gmc("img/lossless.gmc", &width, &height);
+    lqt_from_quadtree(&expected, reference);
+    lqt_from_quadtree(&reloaded, loaded);
+    printf("gmc : %d nodes, %s\n", qt_count_node(loaded),
+        lqt_same_leaves(&expected, &reloaded) ? "identical leaves" : "different leaves");
+
+    lqt_clear(reloaded);
+    lqt_clear(expected);
+    qt_free(loaded);
+    qt_free(reference);
+    qt_free_minimized(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Return 1 if two quadtrees hold the same leaves. */
+int qt_same_leaves(Quadtree a, Quadtree b) {
+    LinearQuadtree la, lb;
+    lqt_init(&la);
+    lqt_init(&lb);
+    lqt_from_quadtree(&la, a);
+    lqt_from_quadtree(&lb, b);
+    int same = lqt_same_leaves(&la, &lb);
+    lqt_clear(lb);
+    lqt_clear(la);
+    return same;
+}
+
+/* Change areas of an image one by one, filling, inverting or shifting their
+pixels, and check the updated trees against trees built again from the
+image, on a plain tree and on a tree minimized without loss. */
+void test_update(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree qt = qt_create_quadtree(&bitmap);
+    Quadtree minimized = qt_create_quadtree(&bitmap);
+    Minimizer minimizer;
+    minimizer_init(&minimizer, minimized, 0);
+
+    double update_time = 0, minimizer_time = 0, build_time = 0;
+    int i, x, y, same = 1, same_minimized = 1;
+    srand(1);
+    for (i = 0; i < UPDATE_ROUNDS; i++)
+    {
+        Area area;
+        int w = bitmap.width / (1 + i % 8), h = bitmap.height / (1 + i % 8);
+        if (w < 1) w = 1;
+        if (h < 1) h = 1;
+        area.width = 1 + rand() % w;
+        area.height = 1 + rand() % h;
+        area.x = rand() % (bitmap.width - area.width + 1);
+        area.y = rand() % (bitmap.height - area.height + 1);
+
+        Color fill = (Color) rand() << 8 | 0xff;
+        for (y = area.y; y < area.y + area.height; y++)
+        {
+            for (x = area.x; x < area.x + area.width; x++)
+            {
+                Color *pixel = &BITMAP_PIXEL(&bitmap, x, y);
+                if(i % 3 == 0)
+                    *pixel = fill;
+                else if(i % 3 == 1)
+                    *pixel = ~*pixel | 0xff;
+                else
+                    *pixel = BITMAP_PIXEL(&bitmap, (x + 1) % bitmap.width, y);
+            }
+        }
+
+        double start = wall_time();
+        qt_update_area(qt, &bitmap, area, 0);
+        update_time += wall_time() - start;
+
+        start = wall_time();
+        minimizer_update(&minimizer, minimized, &bitmap, area);
+        minimizer_time += wall_time() - start;
+
+        start = wall_time();
+        Quadtree reference = qt_create_quadtree(&bitmap);
+        build_time += wall_time() - start;
+
+        same = same && qt_same_leaves(qt, reference);
+        same_minimized = same_minimized && qt_same_leaves(minimized, reference);
+        qt_free(reference);
+    }
+
+    printf("updates : %lf s, %s\n", update_time, same ? "identical leaves" : "different leaves");
+    printf("minimized updates : %lf s, %s\n", minimizer_time,
+        same_minimized ? "identical leaves" : "different leaves");
+    printf("rebuilds : %lf s\n", build_time);
+
+    Quadtree reference = qt_create_quadtree(&bitmap);
+    double start = wall_time();
+    minimize_lossless(reference);
+    printf("lossless minimization : %lf s, %d nodes against %d updated\n", wall_time() - start,
+        qt_count_node(reference), qt_count_node(minimized));
+
+    minimizer_clear(minimizer);
+    qt_free_minimized(reference);
+    qt_free_minimized(minimized);
+    qt_free(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Build and load an image with and without hash-consing, comparing the
+trees and the nodes allocated, then the distinct nodes left by
+minimize_lossless. */
+void test_shared(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+
+    double start = wall_time();
+    Quadtree qt = qt_create_quadtree(&bitmap);
+    printf("expanded : %lf s, %lu nodes allocated\n", wall_time() - start,
+        (unsigned long) arena_owner(qt)->nb_nodes);
+    start = wall_time();
+    Quadtree shared = qt_create_quadtree_shared(&bitmap);
+    printf("shared : %lf s, %lu nodes allocated, %s\n", wall_time() - start,
+        (unsigned long) arena_owner(shared)->nb_nodes, qt_equals(qt, shared) ? "identical trees" : "different trees");
+
+    size_t leaves, internal_nodes;
+    qt_get_infos(shared, &leaves, &internal_nodes);
+    minimize_lossless(qt);
+    printf("lossless minimization : %lu distinct nodes against %lu\n",
+        (unsigned long) qt->nb_distinct, (unsigned long) (leaves + internal_nodes));
+
+    char *files[] = {"img/shared.qtc", "img/shared.gmc"};
+    int i, width, height;
+    for (i = 0; i < 2; i++)
+    {
+        enc_save(shared, bitmap.width, bitmap.height, files[i]);
+        Quadtree loaded = enc_load(files[i], &width, &height);
+        Quadtree loaded_shared = enc_load_shared(files[i], &width, &height);
+        printf("%s : %lu nodes allocated against %lu, %s\n", files[i],
+            (unsigned long) arena_owner(loaded_shared)->nb_nodes, (unsigned long) arena_owner(loaded)->nb_nodes,
+            qt_equals(loaded, loaded_shared) ? "identical trees" : "different trees");
+        qt_free_minimized(loaded_shared);
+        qt_free_minimized(loaded);
+    }
+
+    qt_free_minimized(shared);
+    qt_free_minimized(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Write the first bytes of a file to another one, replacing the width and
+height of its header if forged is not 0. Return 0 if a file can't be opened. */
+int write_damaged_copy(char* src, char* dest, long nb_bytes, int forged, uint32_t width, uint32_t height) {
+    FILE *in = fopen(src, "rb"), *out = fopen(dest, "wb");
+    long i;
+    int c;
+
+    if(in == NULL || out == NULL) {
+        if(in != NULL) fclose(in);
+        if(out != NULL) fclose(out);
+        return 0;
+    }
+    for (i = 0; i < nb_bytes && (c = fgetc(in)) != EOF; i++)
+    {
+        if(forged && i >= 4 && i < 8)
+            c = width >> 8 * (7 - i) & 0xFF;
+        else if(forged && i >= 8 && i < 12)
+            c = height >> 8 * (11 - i) & 0xFF;
+        fputc(c, out);
+    }
+
+    fclose(in);
+    fclose(out);
+    return 1;
+}
+
+/* Save an image to qtc and qte files, before and after a lossy minimization,
+and check that both files load to the same leaves. Truncated files and
+forged headers must then be rejected. */
+void test_qte(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree trees[2];
+    char *names[2] = {"plain", "minimized"};
+    int i, width, height;
+
+    trees[0] = qt_create_quadtree(&bitmap);
+    trees[1] = qt_create_quadtree(&bitmap);
+    minimize_loss(trees[1], DISTANCE_RATE);
+
+    for (i = 0; i < 2; i++)
+    {
+        enc_save(trees[i], bitmap.width, bitmap.height, "img/entropy.qtc");
+        enc_save(trees[i], bitmap.width, bitmap.height, "img/entropy.qte");
+        Quadtree qtc = enc_load("img/entropy.qtc", &width, &height);
+        Quadtree qte = enc_load("img/entropy.qte", &width, &height);
+        Quadtree qte_shared = enc_load_shared("img/entropy.qte", &width, &height);
+
+        size_t qtc_size = enc_size(trees[i], bitmap.width, bitmap.height, "img/entropy.qtc");
+        size_t qte_size = enc_size(trees[i], bitmap.width, bitmap.height, "img/entropy.qte");
+        printf("%s : qtc %lu bytes, qte %lu bytes (%.1lf%%), %s\n", names[i],
+            (unsigned long) qtc_size, (unsigned long) qte_size, 100.0 * qte_size / qtc_size,
+            qte != NULL && width == bitmap.width && height == bitmap.height && qt_same_leaves(qtc, qte) &&
+            qt_equals(qte, qte_shared) ? "same leaves" : "different leaves");
+
+        qt_free_minimized(qte_shared);
+        qt_free(qte);
+        qt_free(qtc);
+    }
+
+    long qte_bytes = enc_size(trees[1], bitmap.width, bitmap.height, "img/entropy.qte");
+    char *damages[5] = {"a third", "header only", "1Mx1M header", "zero width", "negative width"};
+    long nb_bytes[5] = {qte_bytes / 3, 12, 12, qte_bytes, qte_bytes};
+    uint32_t widths[5] = {0, 0, 1 << 20, 0, 0x80000000u};
+    uint32_t heights[5] = {0, 0, 1 << 20, bitmap.height, bitmap.height};
+    for (i = 0; i < 5; i++)
+    {
+        write_damaged_copy("img/entropy.qte", "img/damaged.qte", nb_bytes[i], i >= 2, widths[i], heights[i]);
+        Quadtree damaged = enc_load("img/damaged.qte", &width, &height);
+        printf("%s : %s\n", damages[i], damaged == NULL ? "rejected" : "loaded");
+        qt_free(damaged);
+    }
+
+    qt_free_minimized(trees[1]);
+    qt_free(trees[0]);
+    bitmap_clear(bitmap);
+}
+
+/* Add the pixels of a leaf of an indexed quadtree. */
+void count_indexed_pixels(Area area, Color color, void *data) {
+    size_t *pixels = data;
+    *pixels += (size_t) area.width * area.height;
+}
+
+/* Save an image to qtp files with a palette of the leaf colors and with a
+small quantized one. Each file is loaded to a quadtree, which has the same
+leaves as the image when the palette is exact, and kept in its indexed form. */
+void test_qtp(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree qt = qt_create_quadtree(&bitmap);
+    size_t max_colors[2] = {QTP_COLORS, 16};
+    int i, width, height;
+
+    size_t qtc_size = enc_size(qt, bitmap.width, bitmap.height, "img/palette.qtc");
+    for (i = 0; i < 2; i++)
+    {
+        enc_save_to_qtp(qt, bitmap.width, bitmap.height, "img/palette.qtp", max_colors[i]);
+        Quadtree loaded = enc_load_qtp("img/palette.qtp", &width, &height);
+        IndexedQuadtree indexed;
+        if(loaded == NULL || !enc_load_indexed("img/palette.qtp", &indexed)) {
+            printf("qtp %lu : failed\n", (unsigned long) max_colors[i]);
+            qt_free(loaded);
+            continue;
+        }
+
+        size_t pixels = 0, leaves, internal_nodes;
+        enc_indexed_for_each_leaf(&indexed, count_indexed_pixels, &pixels);
+        Quadtree expanded = enc_indexed_to_quadtree(&indexed, 0);
+        qt_get_infos(loaded, &leaves, &internal_nodes);
+
+        printf("qtp %lu : %lu colors, %lu bytes against %lu for qtc, ", (unsigned long) max_colors[i],
+            (unsigned long) indexed.palette.size, (unsigned long) enc_size(loaded, width, height, "img/palette.qtp"),
+            (unsigned long) qtc_size);
+        if(qt_same_leaves(qt, loaded))
+            printf("same leaves\n");
+        else
+            printf("%.2lf dB\n", rate_psnr(loaded, &bitmap));
+        printf("indexed : %lu bytes against %lu for the nodes, %s\n", (unsigned long) enc_indexed_memory(&indexed),
+            (unsigned long) ((leaves + internal_nodes) * sizeof(Node)),
+            width == bitmap.width && height == bitmap.height && qt_equals(loaded, expanded) &&
+            pixels == (size_t) bitmap.width * bitmap.height ? "same tree" : "different tree");
+
+        qt_free(expanded);
+        enc_indexed_clear(indexed);
+        qt_free(loaded);
+    }
+
+    qt_free(qt);
+    bitmap_clear(bitmap);
+}
+
 void test_save() {
     MLV_create_window("", "", IMG_SIZE, IMG_SIZE);
-    MLV_Image* img = MLV_load_image("res/img/beach.jpg");
-    Quadtree qt = qt_create_quadtree(img);
+    Bitmap bitmap;
+    load_bitmap("res/img/beach.jpg", &bitmap);
+    Quadtree qt = qt_create_quadtree(&bitmap);
 
-    enc_save(qt, "img/beach.qtc");
+    enc_save(qt, bitmap.width, bitmap.height, "img/beach.qtc");
 
     qt_free_minimized(qt);
-    MLV_free_image(img);
+    bitmap_clear(bitmap);
     MLV_free_window();
 }
 
+/* Convert an image to a quadtree file without opening any window. The
+tree is lossless unless a maximum size of the qtn or qtc file is given. */
+void convert_file(char* src, char* dest, size_t max_bytes) {
+    Bitmap bitmap;
+    if(max_bytes != 0 && enc_nodes_size(0, 0, dest) == 0) {
+        printf("a maximum size requires a qtn or qtc destination\n");
+        return;
+    }
+    if(!ingest_load(src, &bitmap)) {
+        printf("headless conversion requires a ppm, pgm or pam file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Quadtree qt;
+    if(max_bytes == 0) {
+        qt = qt_create_quadtree_bottom_up(&bitmap, 0);
+    } else {
+        BuildBudget budget = {0, max_bytes, dest, 0};
+        qt = budget_create_quadtree(&bitmap, budget);
+    }
+    if(enc_save(qt, bitmap.width, bitmap.height, dest) == 0) {
+        printf("invalid filename\n");
+    }
+
+    qt_free(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Convert an image minimized with the distance meeting a target. */
+void convert_file_rate(char* src, char* dest, RateTarget target) {
+    Bitmap bitmap;
+    if(!ingest_load(src, &bitmap)) {
+        printf("headless conversion requires a ppm, pgm or pam file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    RateResult result;
+    Quadtree qt = rate_minimize(&bitmap, target, dest, &result);
+    printf("distance %lf : %lu bytes, %lu nodes, %lf dB%s\n", result.distance,
+        (unsigned long) result.nb_bytes, (unsigned long) result.nb_nodes, result.psnr,
+        result.met ? "" : ", target not met");
+
+    if(enc_save(qt, bitmap.width, bitmap.height, dest) == 0) {
+        printf("invalid filename\n");
+    }
+
+    qt_free_minimized(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Convert an image to a qtp file whose colors index a palette. */
+void convert_file_palette(char* src, char* dest, size_t max_colors) {
+    Bitmap bitmap;
+    if(!ingest_load(src, &bitmap)) {
+        printf("headless conversion requires a ppm, pgm or pam file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Quadtree qt = qt_create_quadtree(&bitmap);
+    enc_save_to_qtp(qt, bitmap.width, bitmap.height, dest, max_colors);
+
+    qt_free(qt);
+    bitmap_clear(bitmap);
+}
+
+/* Convert an image too large for memory, reading it tile by tile. */
+void convert_file_tiled(char* src, char* dest) {
+    int width, height;
+    Quadtree qt = tiled_create_quadtree(src, TILED_DEFAULT_TILE, 0, &width, &height);
+    if(qt == NULL) {
+        printf("tiled conversion requires a ppm, pgm or pam file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(enc_save(qt, width, height, dest) == 0) {
+        printf("invalid filename\n");
+    }
+
+    qt_free(qt);
+}
+
+/* Compare the tiled construction, with small tiles, to the construction from
+the whole bitmap. */
+void test_tiled(char* filename) {
+    Bitmap bitmap;
+    load_bitmap(filename, &bitmap);
+    Quadtree qt = qt_create_quadtree(&bitmap);
+
+    int tile_size, width, height;
+    for (tile_size = 1; tile_size <= 256; tile_size *= 4)
+    {
+        Quadtree tiled = tiled_create_quadtree(filename, tile_size, 0, &width, &height);
+        printf("tiles of %d pixels : %s\n", tile_size,
+            tiled != NULL && qt_equals(qt, tiled) ? "identical trees" : "different trees");
+        qt_free(tiled);
+    }
+
+    qt_free(qt);
+    bitmap_clear(bitmap);
+}
+
 void test_load() {
     MLV_create_window("", "", IMG_SIZE, IMG_SIZE);
-    Quadtree qt = enc_load_qtc("img/beach.qtc");
+    int width, height;
+    Quadtree qt = enc_load_qtc("img/beach.qtc", &width, &height);
 
-    draw_quadtree_image(0, 0, qt, STANDARD);
+    draw_fitted(qt, width, height);
     MLV_actualise_window();
     MLV_wait_milliseconds(250);
 
@@ -81,9 +731,10 @@ void test_load() {
 
 void open_file(char* filename) {
     MLV_create_window("", "", IMG_SIZE, IMG_SIZE);
-    Quadtree qt = enc_load(filename);
+    int width, height;
+    Quadtree qt = enc_load(filename, &width, &height);
 
-    draw_quadtree_image(0, 0, qt, STANDARD);
+    draw_fitted(qt, width, height);
     MLV_actualise_window();
     while(MLV_get_mouse_button_state(MLV_BUTTON_LEFT) != MLV_PRESSED);
 
@@ -112,12 +763,158 @@ int main(int argc, char *argv[])
                 measure_minimize(argv[i]);
             }
         }
+        if(strcmp(argv[i], "--time-build") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                measure_build(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--bench-kernels") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                bench_kernels(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--bench-bbuf") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                bench_bit_buffer(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-linear") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_linear(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-tiled") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_tiled(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-lossless") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_lossless(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-update") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_update(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-shared") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_shared(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-qte") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_qte(argv[i]);
+            }
+        }
+        if(strcmp(argv[i], "--test-qtp") == 0) {
+            if(i + 1 >= argc) {
+                printf("invalid argument: a file must be specified\n");
+
+            }
+            else {
+                i++;
+                test_qtp(argv[i]);
+            }
+        }
         if(strcmp(argv[i], "--test-load") == 0) {
             test_load();
         }
         if(strcmp(argv[i], "--test-save") == 0) {
             test_save();
         }
+        if(strcmp(argv[i], "-c") == 0) {
+            if(i + 2 >= argc) {
+                printf("invalid argument: a source and a destination must be specified\n");
+            }
+            else {
+                convert_file(argv[i + 1], argv[i + 2], 0);
+                i += 2;
+            }
+        }
+        if(strcmp(argv[i], "-ct") == 0) {
+            if(i + 2 >= argc) {
+                printf("invalid argument: a source and a destination must be specified\n");
+            }
+            else {
+                convert_file_tiled(argv[i + 1], argv[i + 2]);
+                i += 2;
+            }
+        }
+        if(strcmp(argv[i], "-cp") == 0) {
+            if(i + 3 >= argc) {
+                printf("invalid argument: a source, a destination and a number of colors must be specified\n");
+            }
+            else {
+                convert_file_palette(argv[i + 1], argv[i + 2], atol(argv[i + 3]));
+                i += 3;
+            }
+        }
+        if(strcmp(argv[i], "-cb") == 0) {
+            if(i + 3 >= argc) {
+                printf("invalid argument: a source, a destination and a size must be specified\n");
+            }
+            else {
+                convert_file(argv[i + 1], argv[i + 2], atol(argv[i + 3]));
+                i += 3;
+            }
+        }
+        if(strcmp(argv[i], "-cr") == 0) {
+            if(i + 5 >= argc) {
+                printf("invalid argument: a source, a destination, a size, a node count and a psnr must be specified\n");
+            }
+            else {
+                RateTarget target = {atol(argv[i + 3]), atol(argv[i + 4]), atof(argv[i + 5])};
+                convert_file_rate(argv[i + 1], argv[i + 2], target);
+                i += 5;
+            }
+        }
         if(strcmp(argv[i], "-o") == 0) {
             if(i + 1 >= argc) {
                 printf("invalid argument: a file must be specified\n");
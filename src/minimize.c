@@ -1,21 +1,95 @@
 /*
-Quadtree minimization using an hash table of Linked List of quadtrees.
+Quadtree minimization. The lossy minimization uses an index of the subtrees
+by mean color, the lossless one an hash of the structure of the subtrees.
 */
 
 #include "../include/minimize.h"
-#include "../include/tree_linked_list.h"
+#include "../include/tree_table.h"
+#include "../include/node_map.h"
+#include "../include/subtree_index.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
 
-/* The size of the hash table. */
-#define SIZE_HTABLE 1000000
+/* Number of tables of the parallel minimization, each one with its lock. */
+#define NB_STRIPES 64
 
-/* Define by how much the color should be grouped up when indexing the
-hash table.
-*/
-#define GROUP_FACTOR 3000
+/* Largest number of threads of the parallel minimization. */
+#define MAX_CLASS_THREADS 64
+
+/* Smallest number of nodes of a height given to each thread. */
+#define MIN_NODES_PER_THREAD 1024
+
+/* Position of the missing children of a node. */
+#define NO_CHILD ((size_t) -1)
+
+/**
+ * A node being classified, with the classes of its children.
+ */
+typedef struct {
+    Quadtree node;
+    size_t children[QT_MAX_NODE];
+    NodeMap *classes;
+    int leaves_only;
+} ClassProbe;
 
-static void minimize_with_hashtable(Quadtree tree, TreeLinkedList tree_hashtable[SIZE_HTABLE], double distance);
+/**
+ * Classes of the parallel minimization. The distinct nodes are numbered in
+ * post-order, and the class of a node is the position of its representative.
+ * The nodes are only read through their positions once collected.
+ */
+typedef struct {
+    size_t nb_nodes;
+    Quadtree *nodes;
+    /* Colors, heights and positions of the children of each node, the
+    missing children being NO_CHILD. */
+    Color *colors;
+    uint16_t *heights;
+    size_t (*children)[QT_MAX_NODE];
+    /* Positions of the nodes collected, only filled for a shared tree. */
+    NodeMap positions;
+    /* Positions sorted by height. */
+    size_t *order;
+    size_t *classes;
+    TreeTable tables[NB_STRIPES];
+    /* Position of the node of each entry of the tables. */
+    size_t *entry_positions[NB_STRIPES];
+    size_t entry_capacities[NB_STRIPES];
+    pthread_mutex_t locks[NB_STRIPES];
+} ParallelClasses;
+
+/**
+ * A range of the nodes of a height given to a thread.
+ */
+typedef struct {
+    ParallelClasses *classes;
+    size_t start;
+    size_t end;
+} ClassWorker;
+
+/**
+ * A node being classified by a thread, with the classes of its children.
+ */
+typedef struct {
+    size_t position;
+    size_t children[QT_MAX_NODE];
+} ParallelProbe;
+
+static void minimize_with_index(Quadtree tree, SubtreeIndex *index, NodeMap *visited);
+static void minimize_children(Quadtree tree, SubtreeIndex *index, NodeMap *visited);
+static void init_classes(Quadtree tree, SubtreeClasses *classes, int leaves_only);
+static size_t classify(Quadtree tree, SubtreeClasses *classes);
+static int same_structure(Quadtree candidate, void *data);
+static size_t collect_postorder(ParallelClasses *classes, Quadtree tree, int shared);
+static void run_class_workers(ParallelClasses *classes, size_t start, size_t end, int nb_threads,
+    void *(*work)(void *));
+static uint32_t probe_node(ParallelClasses *classes, size_t position, ParallelProbe *probe);
+static void *insert_classes(void *arg);
+static void *resolve_classes(void *arg);
+static long find_class(ParallelClasses *classes, size_t stripe, uint32_t hash, ParallelProbe *probe);
+static void add_class(ParallelClasses *classes, size_t stripe, uint32_t hash, size_t position);
 
 /**
  *  Minimize the specified quadtree with the distance value. The minimized quadtree must
@@ -24,49 +98,530 @@ static void minimize_with_hashtable(Quadtree tree, TreeLinkedList tree_hashtable
  * \param distance the distance value to compare two quadtree.
  */
 void minimize_loss(Quadtree tree, double distance) {
-    TreeLinkedList tree_hashtable[SIZE_HTABLE];
-    qt_reset_visited_nodes(tree);
+    Minimizer minimizer;
 
-    size_t i;
-    for (i = 0; i < SIZE_HTABLE; i++)
-    {
-        tree_hashtable[i] = NULL;
-    }
-    
-    minimize_with_hashtable(tree, tree_hashtable, distance);
+    if(tree == NULL) return;
 
-    for (i = 0; i < SIZE_HTABLE; i++)
-    {
-        tll_free(tree_hashtable[i]);
-    }
+    minimizer_init(&minimizer, tree, distance);
+    minimizer_clear(minimizer);
+}
+
+/**
+ * Minimize the specified quadtree with the distance value as minimize_loss
+ * does, keeping the index of its subtrees for minimizer_update. The
+ * minimizer must be released using minimizer_clear, before the tree is freed.
+ * \param minimizer the minimizer to be initialized.
+ * \param tree the tree to be minimized.
+ * \param distance the distance value to compare two quadtree.
+ */
+void minimizer_init(Minimizer *minimizer, Quadtree tree, double distance) {
+    /* Every node is added at most once. */
+    sindex_init(&minimizer->index, qt_count_node(tree), distance);
+    nmap_init(&minimizer->visited);
+
+    if(tree == NULL) return;
+
+    minimize_with_index(tree, &minimizer->index, &minimizer->visited);
+
+    size_t leaves, internal_nodes;
+    qt_get_infos(tree, &leaves, &internal_nodes);
+    tree->nb_distinct = leaves + internal_nodes;
 }
 
-/* Return the index in the hashtable of the specified quadtree. */
-int hashcode(Quadtree tree) {
-    return (tree->color / GROUP_FACTOR) % SIZE_HTABLE;
+/**
+ * Rebuild the part of a minimized quadtree covering an area whose pixels
+ * changed, then minimize the new nodes only, against the subtrees already
+ * indexed. The changed nodes are copied, the root excepted, so the cost
+ * follows the size of the change. The copies replaced by later updates are
+ * only released with the tree, see qt_update_area. The root stays in the
+ * index with the signature it had when minimizer_init indexed it. That is
+ * harmless, as subtrees are only matched with subtrees of the same height
+ * and every subtree looked up is lower than the root.
+ * \param minimizer the minimizer of the tree.
+ * \param tree the tree given to minimizer_init.
+ * \param bitmap the bitmap holding the new pixels.
+ * \param area the area of the bitmap whose pixels changed.
+ */
+void minimizer_update(Minimizer *minimizer, Quadtree tree, Bitmap *bitmap, Area area) {
+    if(tree == NULL) return;
+
+    qt_update_area(tree, bitmap, area, 1);
+
+    /* The root is modified in place, so it is already visited. */
+    minimize_children(tree, &minimizer->index, &minimizer->visited);
 }
 
-/* Fill the hashtable with the specified quadtree nodes. */
-void minimize_with_hashtable(Quadtree tree, TreeLinkedList tree_hashtable[SIZE_HTABLE], double distance) {
-    if(tree == NULL || tree->visited) return;
-    tree->visited = 1;
+/**
+ * Release the specified minimizer. The tree is not freed.
+ * \param minimizer the minimizer to be cleared.
+ */
+void minimizer_clear(Minimizer minimizer) {
+    nmap_clear(minimizer.visited);
+    sindex_clear(minimizer.index);
+}
+
+/* Fill the index with the specified quadtree nodes, replacing the children
+close to a node of the index. */
+void minimize_with_index(Quadtree tree, SubtreeIndex *index, NodeMap *visited) {
+    if(tree == NULL || !nmap_put(visited, tree, 0)) return;
+
+    minimize_children(tree, index, visited);
+    sindex_add(index, tree);
+}
 
+/* Replace the children of a node close to a node of the index, then
+minimize them. */
+void minimize_children(Quadtree tree, SubtreeIndex *index, NodeMap *visited) {
     Quadtree related_tree = NULL;
+    int replaced = 0;
     size_t i;
     for (i = 0; i < QT_MAX_NODE; i++)
     {
         if(qt_is_leaf(tree)) break;
 
-        related_tree = 
-        tll_find_with_distance(tree_hashtable[hashcode(tree->nodes[i])], tree->nodes[i], distance);
+        /* A child already minimized is kept. */
+        if(!nmap_get(visited, tree->nodes[i], NULL))
+            related_tree = sindex_find(index, tree->nodes[i]);
+        else
+            related_tree = NULL;
 
         if(related_tree != NULL) {
             qt_free(tree->nodes[i]);
             tree->nodes[i] = related_tree;
+            replaced = 1;
         }
-        minimize_with_hashtable(tree->nodes[i], tree_hashtable, distance);
+        minimize_with_index(tree->nodes[i], index, visited);
     }
 
-    if(related_tree == NULL) 
-        tll_add(tree_hashtable + hashcode(tree), tree);
-}
\ No newline at end of file
+    /* The children are final, the aggregates can be refreshed. */
+    tree->shared = tree->shared || replaced;
+    qt_cache_node(tree);
+}
+
+/**
+ * Merge the identical subtrees of the specified quadtree, without any loss.
+ * Each subtree is hashed from its color and the classes of its children, so
+ * the whole tree is minimized in a single pass. The minimized quadtree must
+ * be freed using qt_free_minimized.
+ * \param tree the tree to be minimized.
+ */
+void minimize_lossless(Quadtree tree) {
+    SubtreeClasses classes;
+    size_t c, i, child_class;
+
+    if(tree == NULL) return;
+    minimize_classify(tree, &classes);
+
+    /* Children are linked to the first node of their class, children first. */
+    for (c = 0; c < classes.table.nb_entries; c++)
+    {
+        Quadtree node = classes.table.entries[c].tree;
+        for (i = 0; i < QT_MAX_NODE && node->nodes[i] != NULL; i++)
+        {
+            nmap_get(&classes.classes, node->nodes[i], &child_class);
+            if(classes.table.entries[child_class].tree != node->nodes[i]) {
+                node->nodes[i] = classes.table.entries[child_class].tree;
+                node->shared = 1;
+            }
+        }
+        qt_cache_node(node);
+    }
+
+    /* The other nodes are no longer linked. */
+    for (i = 0; i < classes.classes.capacity; i++)
+    {
+        Quadtree node = classes.classes.keys[i];
+        if(node != NULL && !node->in_arena) {
+            c = classes.classes.values[i];
+            if(classes.table.entries[c].tree != node)
+                free(node);
+        }
+    }
+
+    tree->nb_distinct = classes.table.nb_entries;
+    minimize_classes_clear(classes);
+}
+
+/**
+ * Sort the nodes of the specified quadtree into classes of identical
+ * subtrees, same color and same classes of children. The tree is not
+ * modified. The classes must be released using minimize_classes_clear.
+ * \param tree the tree to be classified.
+ * \param classes the classes to be initialized.
+ */
+void minimize_classify(Quadtree tree, SubtreeClasses *classes) {
+    init_classes(tree, classes, 0);
+}
+
+/**
+ * Sort the nodes of the specified quadtree into classes of subtrees with the
+ * same leaves, as minimize_classify does but ignoring the colors of the
+ * internal nodes, which the gm files do not store. The tree is not modified.
+ * The classes must be released using minimize_classes_clear.
+ * \param tree the tree to be classified.
+ * \param classes the classes to be initialized.
+ */
+void minimize_classify_leaves(Quadtree tree, SubtreeClasses *classes) {
+    init_classes(tree, classes, 1);
+}
+
+void init_classes(Quadtree tree, SubtreeClasses *classes, int leaves_only) {
+    nmap_init(&classes->classes);
+    ttable_init(&classes->table, qt_count_node(tree));
+    classes->leaves_only = leaves_only;
+    if(tree != NULL)
+        classify(tree, classes);
+}
+
+/**
+ * Release the specified classes. The nodes are not freed.
+ * \param classes the classes to be cleared.
+ */
+void minimize_classes_clear(SubtreeClasses classes) {
+    nmap_clear(classes.classes);
+    ttable_clear(classes.table);
+}
+
+/* Return the class of a node, classifying its children first. */
+size_t classify(Quadtree tree, SubtreeClasses *classes) {
+    ClassProbe probe;
+    size_t c, i;
+
+    if(nmap_get(&classes->classes, tree, &c)) return c;
+
+    probe.node = tree;
+    probe.classes = &classes->classes;
+    probe.leaves_only = classes->leaves_only;
+
+    uint32_t hash = (classes->leaves_only && !qt_is_leaf(tree) ? 0 : tree->color) * 0x9e3779b1u;
+    for (i = 0; i < QT_MAX_NODE && tree->nodes[i] != NULL; i++)
+    {
+        probe.children[i] = classify(tree->nodes[i], classes);
+        hash = (hash ^ (uint32_t) probe.children[i]) * 0x85ebca6bu;
+    }
+
+    long entry = ttable_find(&classes->table, hash, same_structure, &probe);
+    if(entry == -1) {
+        c = classes->table.nb_entries;
+        ttable_add(&classes->table, hash, tree);
+    } else {
+        c = entry;
+    }
+
+    nmap_put(&classes->classes, tree, c);
+    return c;
+}
+
+/* Return 1 if a node of a class is identical to the probed node, the colors
+of internal nodes being ignored for the leaves_only classes. */
+int same_structure(Quadtree candidate, void *data) {
+    ClassProbe *probe = data;
+    size_t i, child_class;
+
+    if(qt_is_leaf(candidate) != qt_is_leaf(probe->node))
+        return 0;
+    if(candidate->color != probe->node->color && (qt_is_leaf(candidate) || !probe->leaves_only))
+        return 0;
+
+    for (i = 0; i < QT_MAX_NODE && candidate->nodes[i] != NULL; i++)
+    {
+        nmap_get(probe->classes, candidate->nodes[i], &child_class);
+        if(child_class != probe->children[i]) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Minimize the specified quadtree without any loss using several threads.
+ * The nodes are classified one height at a time, those of a height being
+ * shared between the threads. The classes are spread over tables guarded by
+ * their own lock, and the first node of a class in post-order is kept, so
+ * the minimized quadtree is the same as minimize_lossless. It must be freed
+ * using qt_free_minimized.
+ * \param tree the tree to be minimized.
+ * \param nb_threads the number of threads, or 0 for one per processor.
+ */
+void minimize_lossless_parallel(Quadtree tree, int nb_threads) {
+    ParallelClasses classes;
+    size_t i, j, height, nb_heights, nb_classes;
+
+    if(tree == NULL) return;
+    if(nb_threads <= 0)
+        nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nb_threads <= 0)
+        nb_threads = 1;
+
+    qt_cache_aggregates(tree);
+    nb_heights = qt_height(tree) + 1;
+    size_t expected = qt_count_node(tree);
+
+    classes.nb_nodes = 0;
+    classes.nodes = malloc(expected * sizeof(Quadtree));
+    classes.colors = malloc(expected * sizeof(Color));
+    classes.heights = malloc(expected * sizeof(uint16_t));
+    classes.children = malloc(expected * sizeof(*classes.children));
+    classes.order = malloc(expected * sizeof(size_t));
+    classes.classes = malloc(expected * sizeof(size_t));
+    size_t *level_starts = calloc(nb_heights + 1, sizeof(size_t));
+    if(classes.nodes == NULL || classes.colors == NULL || classes.heights == NULL || classes.children == NULL
+        || classes.order == NULL || classes.classes == NULL || level_starts == NULL) {
+        printf("Error malloc ParallelClasses\n");
+        exit(EXIT_FAILURE);
+    }
+    nmap_init(&classes.positions);
+    collect_postorder(&classes, tree, tree->shared);
+
+    /* The nodes are sorted by height, keeping the post-order in a height. */
+    for (i = 0; i < classes.nb_nodes; i++)
+    {
+        level_starts[classes.heights[i] + 1]++;
+    }
+    for (height = 0; height < nb_heights; height++)
+    {
+        level_starts[height + 1] += level_starts[height];
+    }
+    for (i = 0; i < classes.nb_nodes; i++)
+    {
+        height = classes.heights[i];
+        classes.order[level_starts[height]++] = i;
+    }
+    for (height = nb_heights; height > 0; height--)
+    {
+        level_starts[height] = level_starts[height - 1];
+    }
+    level_starts[0] = 0;
+
+    for (i = 0; i < NB_STRIPES; i++)
+    {
+        ttable_init(&classes.tables[i], classes.nb_nodes / NB_STRIPES);
+        classes.entry_capacities[i] = classes.nb_nodes / NB_STRIPES + 1;
+        classes.entry_positions[i] = malloc(classes.entry_capacities[i] * sizeof(size_t));
+        if(classes.entry_positions[i] == NULL) {
+            printf("Error malloc ParallelClasses\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&classes.locks[i], NULL);
+    }
+
+    for (height = 0; height < nb_heights; height++)
+    {
+        run_class_workers(&classes, level_starts[height], level_starts[height + 1], nb_threads, insert_classes);
+        run_class_workers(&classes, level_starts[height], level_starts[height + 1], nb_threads, resolve_classes);
+    }
+
+    /* The representatives are linked to each other, children first. */
+    nb_classes = 0;
+    for (i = 0; i < classes.nb_nodes; i++)
+    {
+        Quadtree node = classes.nodes[i];
+        if(classes.classes[i] != i) continue;
+
+        nb_classes++;
+        for (j = 0; j < QT_MAX_NODE && classes.children[i][j] != NO_CHILD; j++)
+        {
+            Quadtree representative = classes.nodes[classes.classes[classes.children[i][j]]];
+            if(representative != node->nodes[j]) {
+                node->nodes[j] = representative;
+                node->shared = 1;
+            }
+        }
+        qt_cache_node(node);
+    }
+
+    for (i = 0; i < classes.nb_nodes; i++)
+    {
+        if(classes.classes[i] != i && !classes.nodes[i]->in_arena)
+            free(classes.nodes[i]);
+    }
+    tree->nb_distinct = nb_classes;
+
+    for (i = 0; i < NB_STRIPES; i++)
+    {
+        ttable_clear(classes.tables[i]);
+        free(classes.entry_positions[i]);
+        pthread_mutex_destroy(&classes.locks[i]);
+    }
+    nmap_clear(classes.positions);
+    free(level_starts);
+    free(classes.classes);
+    free(classes.order);
+    free(classes.children);
+    free(classes.heights);
+    free(classes.colors);
+    free(classes.nodes);
+}
+
+/* Number the distinct nodes in the order of classify, returning the position
+of the tree. The nodes are only met twice in a shared tree, so the others
+are not looked up. */
+size_t collect_postorder(ParallelClasses *classes, Quadtree tree, int shared) {
+    size_t children[QT_MAX_NODE], position, i;
+
+    if(shared && nmap_get(&classes->positions, tree, &position)) return position;
+    for (i = 0; i < QT_MAX_NODE && tree->nodes[i] != NULL; i++)
+    {
+        children[i] = collect_postorder(classes, tree->nodes[i], shared);
+    }
+    for (; i < QT_MAX_NODE; i++)
+    {
+        children[i] = NO_CHILD;
+    }
+
+    position = classes->nb_nodes++;
+    classes->nodes[position] = tree;
+    classes->colors[position] = tree->color;
+    classes->heights[position] = tree->height;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        classes->children[position][i] = children[i];
+    }
+    if(shared)
+        nmap_put(&classes->positions, tree, position);
+    return position;
+}
+
+/* Run a function on the nodes of a height, each thread taking a range of
+them. */
+void run_class_workers(ParallelClasses *classes, size_t start, size_t end, int nb_threads,
+    void *(*work)(void *)) {
+    pthread_t threads[MAX_CLASS_THREADS];
+    ClassWorker workers[MAX_CLASS_THREADS];
+    int i;
+
+    if(nb_threads > MAX_CLASS_THREADS)
+        nb_threads = MAX_CLASS_THREADS;
+    /* Small heights are not worth a thread. */
+    if((end - start) < MIN_NODES_PER_THREAD * nb_threads)
+        nb_threads = (end - start) / MIN_NODES_PER_THREAD + 1;
+
+    for (i = 0; i < nb_threads; i++)
+    {
+        workers[i].classes = classes;
+        workers[i].start = start + (end - start) * i / nb_threads;
+        workers[i].end = start + (end - start) * (i + 1) / nb_threads;
+    }
+
+    if(nb_threads == 1) {
+        work(&workers[0]);
+        return;
+    }
+
+    for (i = 0; i < nb_threads; i++)
+    {
+        if(pthread_create(&threads[i], NULL, work, &workers[i]) != 0) {
+            printf("Error creating minimization thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < nb_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/* Fill the probe of a node, returning its hash. Its children are already
+classified. */
+uint32_t probe_node(ParallelClasses *classes, size_t position, ParallelProbe *probe) {
+    uint32_t hash = classes->colors[position] * 0x9e3779b1u;
+    size_t i;
+
+    probe->position = position;
+    for (i = 0; i < QT_MAX_NODE && classes->children[position][i] != NO_CHILD; i++)
+    {
+        probe->children[i] = classes->classes[classes->children[position][i]];
+        hash = (hash ^ (uint32_t) probe->children[i]) * 0x85ebca6bu;
+    }
+    for (; i < QT_MAX_NODE; i++)
+    {
+        probe->children[i] = NO_CHILD;
+    }
+    return hash;
+}
+
+/* Add the nodes of a range to the tables, a class keeping its first node in
+post-order whatever the order of the threads. */
+void *insert_classes(void *arg) {
+    ClassWorker *worker = arg;
+    ParallelClasses *classes = worker->classes;
+    ParallelProbe probe;
+    size_t k;
+
+    for (k = worker->start; k < worker->end; k++)
+    {
+        size_t position = classes->order[k];
+        uint32_t hash = probe_node(classes, position, &probe);
+        size_t stripe = hash % NB_STRIPES;
+
+        pthread_mutex_lock(&classes->locks[stripe]);
+        long entry = find_class(classes, stripe, hash, &probe);
+        if(entry == -1)
+            add_class(classes, stripe, hash, position);
+        else if(classes->entry_positions[stripe][entry] > position) {
+            classes->tables[stripe].entries[entry].tree = classes->nodes[position];
+            classes->entry_positions[stripe][entry] = position;
+        }
+        pthread_mutex_unlock(&classes->locks[stripe]);
+    }
+    return NULL;
+}
+
+/* Find the class of the nodes of a range, once the tables are complete for
+their height. */
+void *resolve_classes(void *arg) {
+    ClassWorker *worker = arg;
+    ParallelClasses *classes = worker->classes;
+    ParallelProbe probe;
+    size_t k;
+
+    for (k = worker->start; k < worker->end; k++)
+    {
+        size_t position = classes->order[k];
+        uint32_t hash = probe_node(classes, position, &probe);
+        size_t stripe = hash % NB_STRIPES;
+
+        long entry = find_class(classes, stripe, hash, &probe);
+        classes->classes[position] = classes->entry_positions[stripe][entry];
+    }
+    return NULL;
+}
+
+/* Return the entry of a stripe identical to the probed node, -1 if there is
+none. The children of the nodes of a height are lower, so their classes are
+final. */
+long find_class(ParallelClasses *classes, size_t stripe, uint32_t hash, ParallelProbe *probe) {
+    TreeTable *table = &classes->tables[stripe];
+    Color color = classes->colors[probe->position];
+    long entry;
+    size_t i;
+
+    for (entry = ttable_first(table, hash); entry != -1; entry = table->entries[entry].next)
+    {
+        size_t candidate = classes->entry_positions[stripe][entry];
+        if(classes->colors[candidate] != color) continue;
+
+        for (i = 0; i < QT_MAX_NODE; i++)
+        {
+            size_t child = classes->children[candidate][i];
+            if((child == NO_CHILD ? NO_CHILD : classes->classes[child]) != probe->children[i]) break;
+        }
+        if(i == QT_MAX_NODE) return entry;
+    }
+    return -1;
+}
+
+/* Add a node to a stripe, recording its position with its entry. */
+void add_class(ParallelClasses *classes, size_t stripe, uint32_t hash, size_t position) {
+    size_t entry = classes->tables[stripe].nb_entries;
+
+    if(entry == classes->entry_capacities[stripe]) {
+        classes->entry_capacities[stripe] *= 2;
+        classes->entry_positions[stripe] = realloc(classes->entry_positions[stripe],
+            classes->entry_capacities[stripe] * sizeof(size_t));
+        if(classes->entry_positions[stripe] == NULL) {
+            printf("Error malloc ParallelClasses\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ttable_add(&classes->tables[stripe], hash, classes->nodes[position]);
+    classes->entry_positions[stripe][entry] = position;
+}
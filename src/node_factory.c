@@ -0,0 +1,124 @@
+/*
+Factory of quadtree nodes. Children are made before their parent, so two
+subtrees are identical exactly when their roots have the same color and the
+same children, which are compared by address.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../include/node_factory.h"
+
+/* Number of nodes the table of a factory is first sized for. */
+#define FACTORY_EXPECTED_NODES 1024
+
+/**
+ * A node looked for in the table of a factory.
+ */
+typedef struct {
+    Color color;
+    Quadtree *children;
+} NodeProbe;
+
+static uint32_t hash_node(Color color, Quadtree children[QT_MAX_NODE]);
+static int same_node(Quadtree candidate, void *data);
+
+/**
+ * Initialize a factory allocating in an arena. It must be released using
+ * nfactory_clear, which leaves the nodes in the arena.
+ * \param factory the factory to be initialized.
+ * \param arena the arena in which to allocate the nodes.
+ * \param hash_consing 1 to return the identical nodes already made.
+ */
+void nfactory_init(NodeFactory *factory, NodeArena *arena, int hash_consing)
+{
+    factory->arena = arena;
+    factory->hash_consing = hash_consing;
+    if (hash_consing)
+        ttable_init(&factory->nodes, FACTORY_EXPECTED_NODES);
+}
+
+/**
+ * Release the specified factory. The nodes are not freed.
+ * \param factory the factory to be cleared.
+ */
+void nfactory_clear(NodeFactory factory)
+{
+    if (factory.hash_consing)
+        ttable_clear(factory.nodes);
+}
+
+/**
+ * Return a node of the specified color and children, with its aggregates
+ * cached. With hash-consing, a node made before is returned when it is
+ * identical, and marked as shared.
+ * \param factory the factory making the node.
+ * \param color the color of the node.
+ * \param children the children of the node, made by the same factory, or
+ * NULL for a leaf.
+ * \return the node.
+ */
+Quadtree nfactory_make(NodeFactory *factory, Color color, Quadtree children[QT_MAX_NODE])
+{
+    uint32_t key = 0;
+    size_t i;
+
+    if (factory->hash_consing)
+    {
+        NodeProbe probe;
+        probe.color = color;
+        probe.children = children;
+        key = hash_node(color, children);
+
+        long entry = ttable_find(&factory->nodes, key, same_node, &probe);
+        if (entry != -1)
+        {
+            /* The node is now used by several parents, which record it when
+            caching their aggregates. */
+            Quadtree node = factory->nodes.entries[entry].tree;
+            node->shared = 1;
+            return node;
+        }
+    }
+
+    Quadtree node = qt_create_arena_node(factory->arena, color);
+    for (i = 0; i < QT_MAX_NODE && children != NULL; i++)
+    {
+        node->nodes[i] = children[i];
+    }
+    qt_cache_node(node);
+
+    if (factory->hash_consing)
+        ttable_add(&factory->nodes, key, node);
+    return node;
+}
+
+/* Nodes are aligned, the low bits of the addresses of the children carry no
+information. */
+uint32_t hash_node(Color color, Quadtree children[QT_MAX_NODE])
+{
+    uint32_t hash = (uint32_t) color * 0x9e3779b1u;
+    size_t i;
+
+    for (i = 0; i < QT_MAX_NODE && children != NULL; i++)
+    {
+        hash = (hash ^ (uint32_t) ((uintptr_t) children[i] >> 4)) * 0x85ebca6bu;
+    }
+    return hash ^ (hash >> 16);
+}
+
+int same_node(Quadtree candidate, void *data)
+{
+    NodeProbe *probe = data;
+    size_t i;
+
+    if (candidate->color != probe->color || qt_is_leaf(candidate) != (probe->children == NULL))
+        return 0;
+
+    for (i = 0; i < QT_MAX_NODE && probe->children != NULL; i++)
+    {
+        if (candidate->nodes[i] != probe->children[i])
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,122 @@
+/*
+Map from quadtree nodes to numbers using linear probing. The table is kept
+at most half full.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../include/node_map.h"
+
+/* Initial number of slots, a power of 2. */
+#define NMAP_INITIAL_CAPACITY 64
+
+static size_t slot_of(NodeMap *map, Quadtree node);
+static void grow(NodeMap *map);
+
+/**
+ * Initialize an empty map. It must be released using nmap_clear.
+ * \param map the map to be initialized.
+ */
+void nmap_init(NodeMap *map)
+{
+    map->size = 0;
+    map->capacity = NMAP_INITIAL_CAPACITY;
+    map->keys = calloc(map->capacity, sizeof(Quadtree));
+    map->values = malloc(map->capacity * sizeof(size_t));
+    if (map->keys == NULL || map->values == NULL)
+    {
+        printf("Error malloc NodeMap\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Release the slots of the specified map. The nodes are not freed.
+ * \param map the map to be cleared.
+ */
+void nmap_clear(NodeMap map)
+{
+    free(map.keys);
+    free(map.values);
+}
+
+/**
+ * Associate a value to a node, unless the node is already in the map.
+ * \param map the map to be modified.
+ * \param node the node to be added.
+ * \param value the value of the node.
+ * \return 1 if the node was added, 0 if it was already in the map.
+ */
+int nmap_put(NodeMap *map, Quadtree node, size_t value)
+{
+    size_t slot = slot_of(map, node);
+    if (map->keys[slot] == node)
+        return 0;
+
+    map->keys[slot] = node;
+    map->values[slot] = value;
+    map->size++;
+
+    if (2 * map->size > map->capacity)
+        grow(map);
+    return 1;
+}
+
+/**
+ * Find the value of a node.
+ * \param map the map to search from.
+ * \param node the node to be found.
+ * \param value the pointer which will receive the value, may be NULL.
+ * \return 1 if the node is in the map, 0 otherwise.
+ */
+int nmap_get(NodeMap *map, Quadtree node, size_t *value)
+{
+    size_t slot = slot_of(map, node);
+    if (map->keys[slot] != node)
+        return 0;
+
+    if (value != NULL)
+        *value = map->values[slot];
+    return 1;
+}
+
+/* Return the slot holding the node, or the empty slot where it belongs. */
+size_t slot_of(NodeMap *map, Quadtree node)
+{
+    /* Nodes are aligned, the low bits of their address carry no information. */
+    uint64_t hash = ((uint64_t) (uintptr_t) node >> 4) * 0x9e3779b97f4a7c15ULL;
+    size_t mask = map->capacity - 1;
+    size_t slot = (size_t) (hash >> 32) & mask;
+
+    while (map->keys[slot] != NULL && map->keys[slot] != node)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void grow(NodeMap *map)
+{
+    NodeMap old = *map;
+    size_t i;
+
+    map->capacity *= 2;
+    map->keys = calloc(map->capacity, sizeof(Quadtree));
+    map->values = malloc(map->capacity * sizeof(size_t));
+    if (map->keys == NULL || map->values == NULL)
+    {
+        printf("Error malloc NodeMap\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old.capacity; i++)
+    {
+        if (old.keys[i] != NULL)
+        {
+            size_t slot = slot_of(map, old.keys[i]);
+            map->keys[slot] = old.keys[i];
+            map->values[slot] = old.values[i];
+        }
+    }
+    nmap_clear(old);
+}
@@ -0,0 +1,408 @@
+/*
+Palette of the leaf colors of a quadtree. The distinct leaf colors are
+gathered in a table keyed by color, with the number of pixels holding them.
+When there are more distinct colors than the palette can hold, the box of
+colors with the widest channel is split at the median of the pixels along
+that channel until there are enough boxes, and each box stands for the mean
+of its pixels.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/palette.h"
+#include "../include/tree_table.h"
+
+/**
+ * The distinct leaf colors, a leaf of each color being kept in the table
+ * with the number of pixels of its entry.
+ */
+typedef struct {
+    TreeTable table;
+    size_t *weights;
+    size_t capacity;
+} ColorCounts;
+
+/**
+ * The distinct colors from start to end, which the median cut splits.
+ */
+typedef struct {
+    size_t start;
+    size_t end;
+} ColorBox;
+
+static void gather_colors(Quadtree tree, Area area, ColorCounts *counts);
+static int compare_keys(const void *a, const void *b);
+static size_t *sort_colors(ColorCounts *counts, Color *colors);
+static void median_cut(Palette *palette, Color *colors, size_t *weights, size_t nb_colors, uint32_t *indexes);
+static int widest_channel(Color *colors, size_t start, size_t end, int *range);
+static size_t split_box(Color *colors, size_t *weights, ColorBox box, int channel);
+static Color mean_color(Color *colors, size_t *weights, ColorBox box);
+static Channel channel_of(Color color, int channel);
+
+/**
+ * Build the palette of the leaf colors of a tree, with the map from each of
+ * them to its palette color. The palette holds the distinct colors, sorted,
+ * when there are at most max_colors of them, and quantized colors otherwise.
+ * Both must be released using palette_clear and palette_map_clear.
+ * \param palette the palette to be initialized.
+ * \param map the map to be initialized.
+ * \param tree the tree whose leaf colors are gathered.
+ * \param width the width of the image.
+ * \param height the height of the image.
+ * \param max_colors the largest size of the palette, at least 1.
+ */
+void palette_build(Palette *palette, PaletteMap *map, Quadtree tree, int width, int height, size_t max_colors)
+{
+    Area area = {0, 0, width, height};
+    ColorCounts counts;
+    uint64_t *keys;
+    size_t *weights, i;
+
+    if (max_colors < 1) max_colors = 1;
+    ttable_init(&counts.table, 0);
+    counts.capacity = 1;
+    counts.weights = malloc(counts.capacity * sizeof(size_t));
+    if (counts.weights == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+    if (tree != NULL)
+        gather_colors(tree, area, &counts);
+
+    map->size = counts.table.nb_entries;
+    map->colors = malloc((map->size > 0 ? map->size : 1) * sizeof(Color));
+    if (map->colors == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+    weights = sort_colors(&counts, map->colors);
+    ttable_clear(counts.table);
+    free(counts.weights);
+
+    map->indexes = malloc((map->size > 0 ? map->size : 1) * sizeof(uint32_t));
+    if (map->indexes == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (map->size <= max_colors)
+    {
+        palette->size = map->size;
+        palette->colors = malloc((map->size > 0 ? map->size : 1) * sizeof(Color));
+        if (palette->colors == NULL)
+        {
+            printf("Error malloc Palette\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < map->size; i++)
+        {
+            palette->colors[i] = map->colors[i];
+            map->indexes[i] = i;
+        }
+        free(weights);
+        return;
+    }
+
+    /* The median cut reorders the colors, which are sorted back with their
+    indexes afterwards. */
+    palette->size = max_colors;
+    median_cut(palette, map->colors, weights, map->size, map->indexes);
+    keys = malloc(map->size * sizeof(uint64_t));
+    if (keys == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < map->size; i++)
+    {
+        keys[i] = (uint64_t) map->colors[i] << 32 | map->indexes[i];
+    }
+    qsort(keys, map->size, sizeof(uint64_t), compare_keys);
+    for (i = 0; i < map->size; i++)
+    {
+        map->colors[i] = keys[i] >> 32;
+        map->indexes[i] = (uint32_t) keys[i];
+    }
+    free(keys);
+    free(weights);
+}
+
+/**
+ * Release the specified palette.
+ * \param palette the palette to be cleared.
+ */
+void palette_clear(Palette palette)
+{
+    free(palette.colors);
+}
+
+/**
+ * Release the specified map.
+ * \param map the map to be cleared.
+ */
+void palette_map_clear(PaletteMap map)
+{
+    free(map.colors);
+    free(map.indexes);
+}
+
+/**
+ * Return the index of the palette color standing for a leaf color.
+ * \param map the map of the palette.
+ * \param color a leaf color of the tree of the palette.
+ * \return the index of its palette color, 0 if the color is not in the map.
+ */
+uint32_t palette_map_index(PaletteMap *map, Color color)
+{
+    size_t low = 0, high = map->size;
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (map->colors[middle] < color)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < map->size && map->colors[low] == color ? map->indexes[low] : 0;
+}
+
+/**
+ * Return the number of bits of the indexes of a palette.
+ * \param size the size of the palette.
+ * \return the number of bits telling its colors apart, 0 for a single one.
+ */
+int palette_index_bits(size_t size)
+{
+    int bits = 0;
+
+    while (bits < 32 && ((size_t) 1 << bits) < size)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/* Gather the leaf colors weighted by the pixels they cover, a shared subtree
+counting once for each parent. */
+void gather_colors(Quadtree tree, Area area, ColorCounts *counts)
+{
+    size_t i;
+
+    if (!qt_is_leaf(tree))
+    {
+        for (i = 0; i < QT_MAX_NODE; i++)
+        {
+            gather_colors(tree->nodes[i], get_sub_area(area, i), counts);
+        }
+        return;
+    }
+
+    /* The key is the color, so each key has a single entry. */
+    long entry = ttable_first(&counts->table, tree->color);
+    if (entry != -1)
+    {
+        counts->weights[entry] += (size_t) area.width * area.height;
+        return;
+    }
+
+    if (counts->table.nb_entries == counts->capacity)
+    {
+        counts->capacity *= 2;
+        counts->weights = realloc(counts->weights, counts->capacity * sizeof(size_t));
+        if (counts->weights == NULL)
+        {
+            printf("Error malloc Palette\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    counts->weights[counts->table.nb_entries] = (size_t) area.width * area.height;
+    ttable_add(&counts->table, tree->color, tree);
+}
+
+int compare_keys(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Sort the gathered colors, returning the allocated array of their numbers
+of pixels in the same order. */
+size_t *sort_colors(ColorCounts *counts, Color *colors)
+{
+    size_t nb_colors = counts->table.nb_entries, i;
+    uint64_t *keys = malloc((nb_colors > 0 ? nb_colors : 1) * sizeof(uint64_t));
+    size_t *weights = malloc((nb_colors > 0 ? nb_colors : 1) * sizeof(size_t));
+    if (keys == NULL || weights == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nb_colors; i++)
+    {
+        keys[i] = (uint64_t) counts->table.entries[i].tree->color << 32 | i;
+    }
+    qsort(keys, nb_colors, sizeof(uint64_t), compare_keys);
+    for (i = 0; i < nb_colors; i++)
+    {
+        colors[i] = keys[i] >> 32;
+        weights[i] = counts->weights[(uint32_t) keys[i]];
+    }
+
+    free(keys);
+    return weights;
+}
+
+/* Split the colors into palette->size boxes at most, the palette receiving
+their means and the indexes the box of each color. */
+void median_cut(Palette *palette, Color *colors, size_t *weights, size_t nb_colors, uint32_t *indexes)
+{
+    ColorBox *boxes = malloc(palette->size * sizeof(ColorBox));
+    palette->colors = malloc(palette->size * sizeof(Color));
+    if (boxes == NULL || palette->colors == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t nb_boxes = 1, b, i;
+    boxes[0].start = 0;
+    boxes[0].end = nb_colors;
+
+    while (nb_boxes < palette->size)
+    {
+        int best_channel = -1, best_range = 0, channel, range;
+        size_t best = 0;
+        for (b = 0; b < nb_boxes; b++)
+        {
+            if (boxes[b].end - boxes[b].start < 2) continue;
+            channel = widest_channel(colors, boxes[b].start, boxes[b].end, &range);
+            if (range > best_range)
+            {
+                best_range = range;
+                best_channel = channel;
+                best = b;
+            }
+        }
+        if (best_channel < 0) break;
+
+        size_t split = split_box(colors, weights, boxes[best], best_channel);
+        boxes[nb_boxes].start = split;
+        boxes[nb_boxes].end = boxes[best].end;
+        boxes[best].end = split;
+        nb_boxes++;
+    }
+
+    palette->size = nb_boxes;
+    for (b = 0; b < nb_boxes; b++)
+    {
+        palette->colors[b] = mean_color(colors, weights, boxes[b]);
+        for (i = boxes[b].start; i < boxes[b].end; i++)
+        {
+            indexes[i] = b;
+        }
+    }
+    free(boxes);
+}
+
+/* Return the channel whose values spread the most over some colors, with
+the width of their spread. */
+int widest_channel(Color *colors, size_t start, size_t end, int *range)
+{
+    int best = 0, channel;
+    size_t i;
+
+    *range = -1;
+    for (channel = 0; channel < NB_CHANNELS; channel++)
+    {
+        int low = 255, high = 0;
+        for (i = start; i < end; i++)
+        {
+            int value = channel_of(colors[i], channel);
+            if (value < low) low = value;
+            if (value > high) high = value;
+        }
+        if (high - low > *range)
+        {
+            *range = high - low;
+            best = channel;
+        }
+    }
+    return best;
+}
+
+/* Sort the colors of a box along a channel and return the position of the
+median of their pixels, which leaves a color on each side. */
+size_t split_box(Color *colors, size_t *weights, ColorBox box, int channel)
+{
+    size_t nb_colors = box.end - box.start, total = 0, sum = 0, i;
+    uint64_t *keys = malloc(nb_colors * sizeof(uint64_t));
+    Color *sorted_colors = malloc(nb_colors * sizeof(Color));
+    size_t *sorted_weights = malloc(nb_colors * sizeof(size_t));
+    if (keys == NULL || sorted_colors == NULL || sorted_weights == NULL)
+    {
+        printf("Error malloc Palette\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nb_colors; i++)
+    {
+        keys[i] = (uint64_t) channel_of(colors[box.start + i], channel) << 32 | i;
+        total += weights[box.start + i];
+    }
+    qsort(keys, nb_colors, sizeof(uint64_t), compare_keys);
+    for (i = 0; i < nb_colors; i++)
+    {
+        size_t from = box.start + (uint32_t) keys[i];
+        sorted_colors[i] = colors[from];
+        sorted_weights[i] = weights[from];
+    }
+    for (i = 0; i < nb_colors; i++)
+    {
+        colors[box.start + i] = sorted_colors[i];
+        weights[box.start + i] = sorted_weights[i];
+    }
+
+    for (i = 0; i < nb_colors - 1 && 2 * (sum + weights[box.start + i]) <= total; i++)
+    {
+        sum += weights[box.start + i];
+    }
+
+    free(sorted_weights);
+    free(sorted_colors);
+    free(keys);
+    return box.start + (i > 0 ? i : 1);
+}
+
+/* Return the mean of the colors of a box, weighted by their pixels, or its
+first color when they cover none. */
+Color mean_color(Color *colors, size_t *weights, ColorBox box)
+{
+    double sums[NB_CHANNELS] = {0, 0, 0, 0}, total = 0;
+    int rgba[NB_CHANNELS], channel;
+    size_t i;
+
+    for (i = box.start; i < box.end; i++)
+    {
+        for (channel = 0; channel < NB_CHANNELS; channel++)
+        {
+            sums[channel] += (double) weights[i] * channel_of(colors[i], channel);
+        }
+        total += weights[i];
+    }
+    if (total == 0) return colors[box.start];
+    for (channel = 0; channel < NB_CHANNELS; channel++)
+    {
+        rgba[channel] = (int) (sums[channel] / total + 0.5);
+    }
+    return convert_rgba_to_color(rgba);
+}
+
+Channel channel_of(Color color, int channel)
+{
+    return color >> (8 * (NB_CHANNELS - 1 - channel));
+}
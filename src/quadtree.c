@@ -1,15 +1,87 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "../include/quadtree.h"
-#include "../include/tree_linked_list.h"
+#include "../include/node_map.h"
+#include "../include/node_factory.h"
 
 #define ERROR_RATE 0
 
-static int max_in_array(int *values, size_t size);
-static Quadtree _construct_quadtree(Color bitmap[IMG_SIZE][IMG_SIZE], Area area);
-static void collect_distinct_nodes(Quadtree tree, TreeLinkedList *tree_buffer);
+/* Depth down to which the parallel construction expands the tree before
+handing the remaining subtrees to the worker threads. */
+#define PARALLEL_DEPTH 4
+
+/**
+ * A subtree left to build by a worker of the parallel construction, with
+ * the sums of its area. The subtree is NULL when the area collapses to a
+ * single leaf.
+ */
+typedef struct {
+    Area area;
+    Quadtree tree;
+    ChannelSums sums;
+} BuildTask;
+
+/**
+ * Tasks shared by the workers of the parallel construction.
+ */
+typedef struct {
+    Bitmap *bitmap;
+    BuildTask *tasks;
+    size_t nb_tasks;
+    size_t next_task;
+    pthread_mutex_t lock;
+} BuildPool;
+
+/**
+ * A worker of the parallel construction, allocating in its own arena.
+ */
+typedef struct {
+    BuildPool *pool;
+    NodeArena *arena;
+} BuildWorker;
+
+/**
+ * Stack of the nodes left to visit by a traversal.
+ */
+typedef struct {
+    size_t size;
+    size_t capacity;
+    Quadtree *nodes;
+} NodeStack;
+
+/**
+ * A quadtree being rebuilt over an area whose pixels changed.
+ */
+typedef struct {
+    Bitmap *bitmap;
+    Area changed;
+    Quadtree root;
+    NodeArena *arena;
+    /* The changed nodes but the root are copied instead of being modified. */
+    int copy_nodes;
+} TreeUpdate;
+
+static void stack_push(NodeStack *stack, Quadtree node);
+static Quadtree init_node(Quadtree quadtree, Color value);
+static Quadtree create_quadtree(Bitmap *bitmap, int hash_consing);
+static Quadtree construct_tiles(Bitmap *bitmap, Area area, RegionStats *stats, ChannelSums *sums,
+    NodeFactory *factory);
+static Quadtree _construct_quadtree(RegionStats *stats, Area area, NodeFactory *factory);
+static void expand_build_tasks(BuildPool *pool, Area area, int depth);
+static Quadtree merge_build_tasks(BuildPool *pool, Area area, int depth, ChannelSums *sums, NodeFactory *factory);
+static void *build_worker(void *arg);
+static Quadtree _construct_bottom_up(Bitmap *bitmap, Area area, long tolerance, ChannelSums *sums,
+    NodeFactory *factory);
+static Quadtree merge_subtrees(Quadtree children[QT_MAX_NODE], ChannelSums children_sums[QT_MAX_NODE],
+    Area area, long tolerance, ChannelSums *sums, NodeFactory *factory);
+static Quadtree update_subtree(TreeUpdate *update, Quadtree node, Color color, Area area, ChannelSums *sums);
+static void color_sums(Color color, long nb_pixels, ChannelSums *sums);
+static void count_distinct_nodes(Quadtree tree, size_t *leaves, size_t *internal_nodes);
+static void collect_distinct_nodes(Quadtree tree, NodeMap *visited);
 
 /***
  * Create a new quadtree node with the specified value as color.
@@ -25,109 +97,706 @@ Quadtree qt_create_node(Color value)
         exit(EXIT_FAILURE);
     }
 
+    init_node(quadtree, value);
+    quadtree->in_arena = 0;
+
+    return quadtree;
+}
+
+/**
+ * Create a new quadtree node in an arena. The node is released with the
+ * arena, when the tree owning it is freed.
+ * \param arena the arena in which to allocate the node.
+ * \param value the value of the created quadtree.
+ * \return the allocated quadtree.
+ */
+Quadtree qt_create_arena_node(NodeArena *arena, Color value)
+{
+    Quadtree quadtree = arena_alloc(arena);
+
+    init_node(quadtree, value);
+    quadtree->in_arena = 1;
+
+    return quadtree;
+}
+
+Quadtree init_node(Quadtree quadtree, Color value)
+{
     size_t i;
     for (i = 0; i < QT_MAX_NODE; i++)
     {
         quadtree->nodes[i] = NULL;
     }
     quadtree->color = value;
-    quadtree->visited = 0;
+    quadtree->cached = 0;
+    quadtree->shared = 0;
 
     return quadtree;
 }
 
 /**
- * Create a quadtree from a specified image.
- * \param img the image from which to construct the quadtree.
- * \return the quadtree generated from the image. 
+ * Create a quadtree from a specified bitmap. The root covers the whole
+ * bitmap, whatever its dimensions. The nodes are allocated in an arena owned
+ * by the tree.
+ * \param bitmap the bitmap from which to construct the quadtree.
+ * \return the quadtree generated from the bitmap. 
+ */
+Quadtree qt_create_quadtree(Bitmap *bitmap) {
+    return create_quadtree(bitmap, 0);
+}
+
+/**
+ * Create a quadtree from a specified bitmap as qt_create_quadtree does, each
+ * subtree being built once: identical subtrees are the same nodes, as after
+ * minimize_lossless, without the whole tree being built first. The tree must
+ * be freed using qt_free_minimized.
+ * \param bitmap the bitmap from which to construct the quadtree.
+ * \return the quadtree generated from the bitmap.
  */
-Quadtree qt_create_quadtree(MLV_Image *img) {
-    Color bitmap[IMG_SIZE][IMG_SIZE];
-    convert_img_to_bitmap(img, bitmap);
-    return _construct_quadtree(bitmap, (Area) {0, 0, IMG_SIZE, IMG_SIZE});
+Quadtree qt_create_quadtree_shared(Bitmap *bitmap) {
+    return create_quadtree(bitmap, 1);
+}
+
+Quadtree create_quadtree(Bitmap *bitmap, int hash_consing) {
+    Area area = {0, 0, bitmap->width, bitmap->height};
+    RegionStats stats;
+    NodeFactory factory;
+    NodeArena *arena = arena_create();
+    ChannelSums sums;
+    Quadtree tree;
+
+    region_stats_init(&stats);
+    nfactory_init(&factory, arena, hash_consing);
+    tree = construct_tiles(bitmap, area, &stats, &sums, &factory);
+    if (tree == NULL)
+        tree = nfactory_make(&factory, sums_average_color(&sums, (long) area.width * area.height), NULL);
+    nfactory_clear(factory);
+    region_stats_clear(stats);
+
+    arena->root = tree;
+    return tree;
 }
 
-Quadtree _construct_quadtree(Color bitmap[IMG_SIZE][IMG_SIZE], Area area)
+/* The bitmap is split like the tree until the areas fit in the summed-area
+tables, so they never cover more than REGION_TILE_PIXELS pixels. The larger
+areas are merged from their children as in the bottom-up construction, and
+NULL is returned when the area collapses to a single leaf. */
+Quadtree construct_tiles(Bitmap *bitmap, Area area, RegionStats *stats, ChannelSums *sums,
+    NodeFactory *factory)
 {
-    Quadtree quadtree = qt_create_node(bitmap_average_color(bitmap, area));
+    if ((long) area.width * area.height <= REGION_TILE_PIXELS)
+    {
+        region_stats_load(stats, bitmap, area);
+        region_sums(stats, area, sums);
+        if (sums_error_value(sums, (long) area.width * area.height) <= ERROR_RATE)
+            return NULL;
+        return _construct_quadtree(stats, area, factory);
+    }
 
-    if (error_value(bitmap, area) <= ERROR_RATE)
-        return quadtree;
+    Quadtree children[QT_MAX_NODE];
+    ChannelSums children_sums[QT_MAX_NODE];
+    size_t i;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        children[i] = construct_tiles(bitmap, get_sub_area(area, i), stats, &children_sums[i], factory);
+    }
+
+    return merge_subtrees(children, children_sums, area, ERROR_RATE, sums, factory);
+}
+
+/* Each node measures its area in constant time from the summed-area tables.
+The children are made before their parent. */
+Quadtree _construct_quadtree(RegionStats *stats, Area area, NodeFactory *factory)
+{
+    Quadtree children[QT_MAX_NODE];
+    Color color = region_average_color(stats, area);
+
+    if (region_error_value(stats, area) <= ERROR_RATE)
+        return nfactory_make(factory, color, NULL);
 
     size_t i;
     for (i = 0; i < QT_MAX_NODE; i++)
     {
-        quadtree->nodes[i] = _construct_quadtree(bitmap, get_sub_area(area, i));
-    }    
+        children[i] = _construct_quadtree(stats, get_sub_area(area, i), factory);
+    }
 
-    return quadtree;
+    return nfactory_make(factory, color, children);
 }
 
 /**
- * Free an allocated quadtree.
- * \param quadtree the quadtree to be freed. 
+ * Create a quadtree from a specified bitmap, starting from the pixels and
+ * merging blocks of four children upward. Each pixel is read once, and blocks
+ * of four uniform children are collapsed before being allocated. The tree is
+ * the same as qt_create_quadtree when the tolerance equals ERROR_RATE.
+ * \param bitmap the bitmap from which to construct the quadtree.
+ * \param tolerance the maximum error value of a merged area, 0 for lossless.
+ * \return the quadtree generated from the bitmap.
  */
-void qt_free(Quadtree quadtree)
+Quadtree qt_create_quadtree_bottom_up(Bitmap *bitmap, long tolerance) {
+    Area area = {0, 0, bitmap->width, bitmap->height};
+    NodeArena *arena = arena_create();
+    NodeFactory factory;
+    ChannelSums sums;
+    Quadtree tree;
+
+    nfactory_init(&factory, arena, 0);
+    tree = _construct_bottom_up(bitmap, area, tolerance, &sums, &factory);
+    if (tree == NULL)
+        tree = nfactory_make(&factory, sums_average_color(&sums, (long) area.width * area.height), NULL);
+    nfactory_clear(factory);
+
+    arena->root = tree;
+    return tree;
+}
+
+/**
+ * Build the subtree of a bitmap bottom-up in an arena, as done by
+ * qt_create_quadtree_bottom_up, without allocating the root when the whole
+ * bitmap collapses to a single leaf. Used to build large images by parts.
+ * \param bitmap the bitmap from which to construct the subtree.
+ * \param tolerance the maximum error value of a merged area, 0 for lossless.
+ * \param sums the pointer which will receive the sums of the bitmap.
+ * \param arena the arena in which to allocate the nodes.
+ * \return the subtree, or NULL if the bitmap collapses to a single leaf.
+ */
+Quadtree qt_bottom_up_subtree(Bitmap *bitmap, long tolerance, ChannelSums *sums, NodeArena *arena)
 {
-    if (quadtree != NULL)
+    NodeFactory factory;
+    Quadtree tree;
+
+    nfactory_init(&factory, arena, 0);
+    tree = _construct_bottom_up(bitmap, (Area) {0, 0, bitmap->width, bitmap->height}, tolerance, sums, &factory);
+    nfactory_clear(factory);
+    return tree;
+}
+
+/* Return NULL when the area collapses to a single leaf. The leaf is only
+allocated by the parent once it knows it cannot merge it. */
+Quadtree _construct_bottom_up(Bitmap *bitmap, Area area, long tolerance, ChannelSums *sums,
+    NodeFactory *factory)
+{
+    Quadtree children[QT_MAX_NODE];
+    ChannelSums children_sums[QT_MAX_NODE];
+    size_t i, k;
+
+    if (area.width * area.height <= 1)
     {
-        size_t i;
-        for (i = 0; i < QT_MAX_NODE; i++)
+        for (k = 0; k < 4; k++)
+        {
+            sums->sum[k] = 0;
+            sums->square[k] = 0;
+        }
+
+        if (area.width * area.height == 1)
         {
-            qt_free(quadtree->nodes[i]);
+            Color color = BITMAP_PIXEL(bitmap, area.x, area.y);
+            uint64_t channels[4];
+
+            channels[RED] = red(color);
+            channels[GREEN] = green(color);
+            channels[BLUE] = blue(color);
+            channels[ALPHA] = alpha(color);
+            for (k = 0; k < 4; k++)
+            {
+                sums->sum[k] = channels[k];
+                sums->square[k] = channels[k] * channels[k];
+            }
         }
-        free(quadtree);
+        return NULL;
     }
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        children[i] = _construct_bottom_up(bitmap, get_sub_area(area, i), tolerance, &children_sums[i], factory);
+    }
+
+    return merge_subtrees(children, children_sums, area, tolerance, sums, factory);
 }
 
 /**
- * Count the number of node in a quadtree.
- * \param tree the tree to be counted.
- * \return the number of node in the quadtree.
+ * Merge the four subtrees of an area built bottom-up. When every child
+ * collapsed and the error of the area is within the tolerance, the area
+ * collapses too. Otherwise the collapsed children are allocated as leaves
+ * under a new node.
+ * \param children the subtrees, NULL for the collapsed ones.
+ * \param children_sums the sums of the sub-areas.
+ * \param area the area covered by the children.
+ * \param tolerance the maximum error value of a merged area, 0 for lossless.
+ * \param sums the pointer which will receive the sums of the area.
+ * \param arena the arena in which to allocate the nodes.
+ * \return the merged subtree, or NULL if the area collapses to a single leaf.
  */
-int qt_count_node(Quadtree tree) {
-    if(tree == NULL || tree->visited) return 0;
-    tree->visited = 1;
+Quadtree qt_merge_subtrees(Quadtree children[QT_MAX_NODE], ChannelSums children_sums[QT_MAX_NODE],
+    Area area, long tolerance, ChannelSums *sums, NodeArena *arena)
+{
+    NodeFactory factory;
+    Quadtree tree;
+
+    nfactory_init(&factory, arena, 0);
+    tree = merge_subtrees(children, children_sums, area, tolerance, sums, &factory);
+    nfactory_clear(factory);
+    return tree;
+}
+
+/* The collapsed children are made by the factory, so identical leaves are
+shared with hash-consing. */
+Quadtree merge_subtrees(Quadtree children[QT_MAX_NODE], ChannelSums children_sums[QT_MAX_NODE],
+    Area area, long tolerance, ChannelSums *sums, NodeFactory *factory)
+{
+    Area sub_areas[QT_MAX_NODE];
+    int uniform = 1;
+    size_t i, k;
 
-    size_t i, sum;
-    for (i = 0, sum = 0; i < QT_MAX_NODE; i++)
+    for (k = 0; k < 4; k++)
     {
-        sum += qt_count_node(tree->nodes[i]);
+        sums->sum[k] = 0;
+        sums->square[k] = 0;
     }
-    return sum + 1;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        sub_areas[i] = get_sub_area(area, i);
+        uniform = uniform && children[i] == NULL;
+
+        for (k = 0; k < 4; k++)
+        {
+            sums->sum[k] += children_sums[i].sum[k];
+            sums->square[k] += children_sums[i].square[k];
+        }
+    }
+
+    long nb_pixels = (long) area.width * area.height;
+    if (uniform && sums_error_value(sums, nb_pixels) <= tolerance)
+        return NULL;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        if (children[i] == NULL)
+            children[i] = nfactory_make(factory, sums_average_color(&children_sums[i],
+                (long) sub_areas[i].width * sub_areas[i].height), NULL);
+    }
+
+    return nfactory_make(factory, sums_average_color(sums, nb_pixels), children);
 }
 
 /**
- * Return the height in a specified quadtree.
- * \param quadtree the quadtree to be evaluated.
- * \return the height of the quadtree.
+ * Rebuild the part of a quadtree covering an area whose pixels changed. Only
+ * the nodes meeting the area are visited, and the pixels of the area read, so
+ * the cost follows the size of the change rather than the one of the image.
+ * The leaves are the ones of a tree built again from the bitmap, but the
+ * internal colors above unchanged subtrees are computed from their colors.
+ * The arena only releases its nodes all at once, so the nodes an update
+ * replaces stay allocated until the tree is freed: the memory of the tree
+ * grows with each update by the nodes it copies or adds. A tree updated
+ * many times should be built again once it holds too many dead nodes.
+ * \param tree the quadtree of the bitmap before the change, built in an arena.
+ * \param bitmap the bitmap holding the new pixels.
+ * \param area the area of the bitmap whose pixels changed.
+ * \param copy_nodes 1 to copy the changed nodes but the root instead of
+ * modifying them, as done anyway when the tree holds shared nodes.
  */
-int qt_height(Quadtree quadtree)
+void qt_update_area(Quadtree tree, Bitmap *bitmap, Area area, int copy_nodes)
 {
-    if (quadtree == NULL)
-        return -1;
+    TreeUpdate update;
+    ChannelSums sums;
+
+    if (tree == NULL) return;
+    assert(tree->in_arena);
+
+    update.bitmap = bitmap;
+    update.changed = area;
+    update.root = tree;
+    update.arena = arena_owner(tree);
+    update.copy_nodes = copy_nodes || tree->shared;
+
+    update_subtree(&update, tree, tree->color, (Area) {0, 0, bitmap->width, bitmap->height}, &sums);
+}
+
+/* Return the updated node of an area, NULL standing for a part of a leaf of
+the specified color. Areas left untouched keep their node, and the children
+are merged as done by qt_merge_subtrees. */
+Quadtree update_subtree(TreeUpdate *update, Quadtree node, Color color, Area area, ChannelSums *sums)
+{
+    Quadtree children[QT_MAX_NODE];
+    ChannelSums children_sums[QT_MAX_NODE];
+    long nb_pixels = (long) area.width * area.height;
+    int uniform = 1;
+    size_t i, k;
+
+    if (node != NULL)
+        color = node->color;
+
+    if (!area_intersects(area, update->changed))
+    {
+        color_sums(color, nb_pixels, sums);
+        if (node == NULL)
+        {
+            /* Empty areas are black, as in the builders. */
+            node = qt_create_arena_node(update->arena, sums_average_color(sums, nb_pixels));
+            qt_cache_node(node);
+        }
+        return node;
+    }
+
+    if (nb_pixels == 1)
+    {
+        color = BITMAP_PIXEL(update->bitmap, area.x, area.y);
+        color_sums(color, 1, sums);
+    }
     else
     {
-        int heights[QT_MAX_NODE];
-        size_t i;
+        for (k = 0; k < 4; k++)
+        {
+            sums->sum[k] = 0;
+            sums->square[k] = 0;
+        }
+
         for (i = 0; i < QT_MAX_NODE; i++)
         {
-            heights[i] = qt_height(quadtree->nodes[i]);
+            Quadtree child = node != NULL && !qt_is_leaf(node) ? node->nodes[i] : NULL;
+            children[i] = update_subtree(update, child, color, get_sub_area(area, i), &children_sums[i]);
+            uniform = uniform && qt_is_leaf(children[i]);
+
+            for (k = 0; k < 4; k++)
+            {
+                sums->sum[k] += children_sums[i].sum[k];
+                sums->square[k] += children_sums[i].square[k];
+            }
+        }
+
+        color = sums_average_color(sums, nb_pixels);
+        uniform = uniform && sums_error_value(sums, nb_pixels) <= ERROR_RATE;
+    }
+
+    Quadtree updated = node;
+    if (node == NULL || (update->copy_nodes && node != update->root))
+    {
+        updated = qt_create_arena_node(update->arena, color);
+        updated->shared = node != NULL && node->shared;
+    }
+
+    updated->color = color;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        updated->nodes[i] = nb_pixels == 1 || uniform ? NULL : children[i];
+    }
+
+    qt_cache_node(updated);
+    return updated;
+}
+
+/* Fill the sums of pixels of a single color. */
+void color_sums(Color color, long nb_pixels, ChannelSums *sums)
+{
+    uint64_t channels[4];
+    size_t k;
+
+    channels[RED] = red(color);
+    channels[GREEN] = green(color);
+    channels[BLUE] = blue(color);
+    channels[ALPHA] = alpha(color);
+    for (k = 0; k < 4; k++)
+    {
+        sums->sum[k] = channels[k] * nb_pixels;
+        sums->square[k] = channels[k] * channels[k] * nb_pixels;
+    }
+}
+
+/**
+ * Create a quadtree from a specified bitmap using several threads. The
+ * subtrees at PARALLEL_DEPTH are shared between the threads, each one
+ * allocating in its own arena merged into the arena of the tree, then the
+ * top levels are merged from them. The tree is the same as
+ * qt_create_quadtree.
+ * \param bitmap the bitmap from which to construct the quadtree.
+ * \param nb_threads the number of threads, or 0 for one per processor.
+ * \return the quadtree generated from the bitmap.
+ */
+Quadtree qt_create_quadtree_parallel(Bitmap *bitmap, int nb_threads) {
+    Area area = {0, 0, bitmap->width, bitmap->height};
+    BuildPool pool;
+    NodeArena *arena = arena_create();
+    NodeFactory factory;
+    ChannelSums sums;
+    Quadtree tree;
+    size_t max_tasks = 1;
+    int i;
+
+    if (nb_threads <= 0)
+        nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nb_threads <= 0)
+        nb_threads = 1;
+
+    for (i = 0; i < PARALLEL_DEPTH; i++)
+    {
+        max_tasks *= QT_MAX_NODE;
+    }
+
+    pool.bitmap = bitmap;
+    pool.nb_tasks = 0;
+    pool.next_task = 0;
+    pool.tasks = malloc(max_tasks * sizeof(BuildTask));
+    if (pool.tasks == NULL)
+    {
+        printf("Error malloc BuildPool\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+
+    expand_build_tasks(&pool, area, 0);
+
+    pthread_t *threads = malloc(nb_threads * sizeof(pthread_t));
+    BuildWorker *workers = malloc(nb_threads * sizeof(BuildWorker));
+    if (threads == NULL || workers == NULL)
+    {
+        printf("Error malloc threads\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nb_threads; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].arena = arena_create();
+        if (pthread_create(&threads[i], NULL, build_worker, &workers[i]) != 0)
+        {
+            printf("Error creating construction thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < nb_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        arena_merge(arena, workers[i].arena);
+    }
+
+    free(workers);
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+
+    pool.next_task = 0;
+    nfactory_init(&factory, arena, 0);
+    tree = merge_build_tasks(&pool, area, 0, &sums, &factory);
+    if (tree == NULL)
+        tree = nfactory_make(&factory, sums_average_color(&sums, (long) area.width * area.height), NULL);
+    nfactory_clear(factory);
+    free(pool.tasks);
+
+    arena->root = tree;
+    return tree;
+}
+
+/* Queue the areas reaching PARALLEL_DEPTH for the workers, in pre-order. */
+void expand_build_tasks(BuildPool *pool, Area area, int depth)
+{
+    size_t i;
+
+    if (depth == PARALLEL_DEPTH)
+    {
+        pool->tasks[pool->nb_tasks++].area = area;
+        return;
+    }
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        expand_build_tasks(pool, get_sub_area(area, i), depth + 1);
+    }
+}
+
+/* Merge the top levels of the tree from the built tasks, taken in the order
+of expand_build_tasks. */
+Quadtree merge_build_tasks(BuildPool *pool, Area area, int depth, ChannelSums *sums, NodeFactory *factory)
+{
+    Quadtree children[QT_MAX_NODE];
+    ChannelSums children_sums[QT_MAX_NODE];
+    size_t i;
+
+    if (depth == PARALLEL_DEPTH)
+    {
+        BuildTask *task = &pool->tasks[pool->next_task++];
+        *sums = task->sums;
+        return task->tree;
+    }
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        children[i] = merge_build_tasks(pool, get_sub_area(area, i), depth + 1, &children_sums[i], factory);
+    }
+
+    return merge_subtrees(children, children_sums, area, ERROR_RATE, sums, factory);
+}
+
+/* Build queued subtrees until none is left, each worker loading the
+summed-area tables of its own tiles. */
+void *build_worker(void *arg)
+{
+    BuildWorker *worker = arg;
+    BuildPool *pool = worker->pool;
+    BuildTask *task;
+    RegionStats stats;
+    NodeFactory factory;
+
+    region_stats_init(&stats);
+    nfactory_init(&factory, worker->arena, 0);
+    while (1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->next_task == pool->nb_tasks)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            nfactory_clear(factory);
+            region_stats_clear(stats);
+            return NULL;
         }
+        task = &pool->tasks[pool->next_task++];
+        pthread_mutex_unlock(&pool->lock);
+
+        task->tree = construct_tiles(pool->bitmap, task->area, &stats, &task->sums, &factory);
+    }
+}
+
+/**
+ * Free an allocated quadtree. The arena of a tree is released at once when
+ * its root is freed, while the other arena nodes are left to it.
+ * \param quadtree the quadtree to be freed. 
+ */
+void qt_free(Quadtree quadtree)
+{
+    if (quadtree != NULL && quadtree->in_arena)
+    {
+        NodeArena *arena = arena_owner(quadtree);
+        if (arena->root == quadtree)
+            arena_release(arena);
+    }
+    else if (quadtree != NULL)
+    {
+        NodeStack stack = {0, 0, NULL};
+        size_t i;
 
-        return max_in_array(heights, QT_MAX_NODE) + 1;
+        stack_push(&stack, quadtree);
+        while (stack.size > 0)
+        {
+            Quadtree node = stack.nodes[--stack.size];
+            for (i = 0; i < QT_MAX_NODE; i++)
+            {
+                if (node->nodes[i] != NULL && !node->nodes[i]->in_arena)
+                    stack_push(&stack, node->nodes[i]);
+            }
+            free(node);
+        }
+        free(stack.nodes);
     }
 }
 
-int max_in_array(int *values, size_t size)
+void stack_push(NodeStack *stack, Quadtree node)
 {
-    size_t i, max;
-    for (i = 0, max = values[0]; i < size; i++)
+    if (stack->size == stack->capacity)
     {
-        if (max < values[i])
-            max = values[i];
+        stack->capacity = stack->capacity == 0 ? 64 : 2 * stack->capacity;
+        stack->nodes = realloc(stack->nodes, stack->capacity * sizeof(Quadtree));
+        if (stack->nodes == NULL)
+        {
+            printf("Error malloc NodeStack\n");
+            exit(EXIT_FAILURE);
+        }
     }
-    return max;
+    stack->nodes[stack->size++] = node;
+}
+
+/**
+ * Compute the aggregates of a node from the ones of its children, which must
+ * be cached.
+ * \param node the node to be updated.
+ */
+void qt_cache_node(Quadtree node)
+{
+    size_t i;
+
+    node->nb_nodes = 1;
+    node->nb_leaves = qt_is_leaf(node) ? 1 : 0;
+    node->height = 0;
+
+    for (i = 0; i < QT_MAX_NODE && node->nodes[i] != NULL; i++)
+    {
+        Quadtree child = node->nodes[i];
+        node->nb_nodes += child->nb_nodes;
+        node->nb_leaves += child->nb_leaves;
+        if (child->height + 1 > node->height)
+            node->height = child->height + 1;
+        node->shared = node->shared || child->shared;
+    }
+
+    node->nb_distinct = node->shared ? 0 : node->nb_nodes;
+    node->cached = 1;
+}
+
+/**
+ * Compute the aggregates of every node of a quadtree which are not cached
+ * yet. Subtrees whose root is cached are skipped. The builders and loaders
+ * already cache their trees, so reading them from several threads is safe.
+ * \param tree the tree to be updated.
+ */
+void qt_cache_aggregates(Quadtree tree)
+{
+    if (tree == NULL || tree->cached) return;
+
+    NodeStack stack = {0, 0, NULL};
+    size_t i;
+
+    /* A node is cached once all its children are. */
+    stack_push(&stack, tree);
+    while (stack.size > 0)
+    {
+        Quadtree node = stack.nodes[stack.size - 1];
+        int pending = 0;
+
+        for (i = 0; i < QT_MAX_NODE && !node->cached; i++)
+        {
+            if (node->nodes[i] != NULL && !node->nodes[i]->cached)
+            {
+                stack_push(&stack, node->nodes[i]);
+                pending = 1;
+            }
+        }
+
+        if (!pending)
+        {
+            if (!node->cached)
+                qt_cache_node(node);
+            stack.size--;
+        }
+    }
+    free(stack.nodes);
+}
+
+/**
+ * Count the number of node in a quadtree. Nodes shared by several branches
+ * of a minimized quadtree are counted once.
+ * \param tree the tree to be counted.
+ * \return the number of node in the quadtree.
+ */
+int qt_count_node(Quadtree tree) {
+    if(tree == NULL) return 0;
+
+    qt_cache_aggregates(tree);
+    if(tree->nb_distinct != 0) return tree->nb_distinct;
+
+    size_t leaves, internal_nodes;
+    qt_get_infos(tree, &leaves, &internal_nodes);
+    return leaves + internal_nodes;
+}
+
+/**
+ * Return the height in a specified quadtree, from the cached aggregates.
+ * \param quadtree the quadtree to be evaluated.
+ * \return the height of the quadtree.
+ */
+int qt_height(Quadtree quadtree)
+{
+    if (quadtree == NULL)
+        return -1;
+
+    qt_cache_aggregates(quadtree);
+    return quadtree->height;
 }
 
 /**
@@ -163,28 +832,68 @@ double qt_distance(Quadtree a, Quadtree b) {
 }
 
 /**
- * Return 1 if the specified quadtree is a leaf.
- * \param tree the quadtree to be tested.
- * \return 1 if the tree is a leaf.
+ * Evaluate the distance between two quadtrees as qt_distance does, unless it
+ * is greater than a bound. The children are compared in order and the
+ * comparison stops as soon as their sum can only exceed the bound.
+ *
+ * \param a the quadtree to compare.
+ * \param b the quadtree to compare.
+ * \param bound the largest distance of interest.
+ * \return the distance between the two quadtrees if it is not greater than the
+ * bound, a value greater than the bound otherwise.
  */
-int qt_is_leaf(Quadtree tree) {
-    return tree->nodes[0] == NULL;
+double qt_distance_bounded(Quadtree a, Quadtree b, double bound) {
+    if(a == NULL || b == NULL) return 0;
+
+    int i;
+    double sum, child_bound;
+
+    if(qt_is_leaf(a) && qt_is_leaf(b)){
+        return color_distance(a->color, b->color);
+    }
+
+    sum = 0;
+    for(i = 0; i < QT_MAX_NODE; i++){
+        child_bound = bound * 4 - sum;
+        if (qt_is_leaf(a) && !qt_is_leaf(b)){
+            sum += qt_distance_bounded(a, b->nodes[i], child_bound);
+        }
+        else if (!qt_is_leaf(a) && qt_is_leaf(b)){
+            sum += qt_distance_bounded(b, a->nodes[i], child_bound);
+        }
+        else{
+            sum += qt_distance_bounded(a->nodes[i], b->nodes[i], child_bound);
+        }
+        if(sum > bound * 4) return sum / 4;
+    }
+    return sum / 4;
 }
 
 /**
- * Reset the visited field in the quadtree and all his children, setting it to 0.
- * \param tree the tree to be modified.
+ * Return 1 if the two quadtrees have the same structure and colors.
+ * \param a the quadtree to compare.
+ * \param b the quadtree to compare.
+ * \return 1 if the quadtrees are identical.
  */
-void qt_reset_visited_nodes(Quadtree tree) {
-    if(tree == NULL) return;
-
-    tree->visited = 0;
+int qt_equals(Quadtree a, Quadtree b) {
+    if(a == b) return 1;
+    if(a == NULL || b == NULL || a->color != b->color) return 0;
 
     size_t i;
     for (i = 0; i < QT_MAX_NODE; i++)
     {
-        qt_reset_visited_nodes(tree->nodes[i]);
+        if(!qt_equals(a->nodes[i], b->nodes[i])) return 0;
     }
+    return 1;
+}
+
+/**
+ * Return 1 if the specified quadtree is a leaf.
+ * \param tree the quadtree to be tested.
+ * \return 1 if the tree is a leaf.
+ */
+int qt_is_leaf(Quadtree tree) {
+    return tree->nodes[0] == NULL;
 }
 
 /**
@@ -193,80 +902,147 @@ void qt_reset_visited_nodes(Quadtree tree) {
  * \return the number of leaves in the quadtree.
  */
 int qt_count_leaf(Quadtree tree) {
-    if(tree == NULL || tree->visited) return 0;
+    size_t leaves, internal_nodes;
+    qt_get_infos(tree, &leaves, &internal_nodes);
+    return leaves;
+}
 
-    if(qt_is_leaf(tree) && !tree->visited) {
-        tree->visited = 1;
-        return 1;
-    }
+/**
+ * Return informations about the specified quadtree. Nodes shared by several
+ * branches are counted once. The cached aggregates are used unless the tree
+ * holds shared nodes, which are then marked in a table of the call.
+ * \param tree the tree to get informations from.
+ * \param leaves the pointer which will receive the number of leaves.
+ * \param internal_nodes the pointer wich will receive the number of internal nodes.
+ */ 
+void qt_get_infos(Quadtree tree, size_t *leaves, size_t *internal_nodes) {
+    *leaves = 0;
+    *internal_nodes = 0;
+    if(tree == NULL) return;
 
-    size_t i, sum;
-    for (i = 0, sum = 0; i < QT_MAX_NODE; i++)
-    {
-        sum += qt_count_leaf(tree->nodes[i]);
+    qt_cache_aggregates(tree);
+    if(!tree->shared) {
+        *leaves = tree->nb_leaves;
+        *internal_nodes = tree->nb_nodes - tree->nb_leaves;
+        return;
     }
-    return sum;
+
+    count_distinct_nodes(tree, leaves, internal_nodes);
+    tree->nb_distinct = *leaves + *internal_nodes;
 }
 
 /**
- * Return informations about the specified quadtree.
+ * Return informations about the specified quadtree expanded as a tree, with
+ * shared nodes counted at each use, as written in the qtc and qtn formats.
  * \param tree the tree to get informations from.
  * \param leaves the pointer which will receive the number of leaves.
  * \param internal_nodes the pointer wich will receive the number of internal nodes.
- */ 
-void qt_get_infos(Quadtree tree, size_t *leaves, size_t *internal_nodes) {
-    qt_reset_visited_nodes(tree);
-    *leaves = qt_count_leaf(tree);
-    qt_reset_visited_nodes(tree);
-    *internal_nodes = qt_count_node(tree) - *leaves;
+ */
+void qt_get_tree_infos(Quadtree tree, size_t *leaves, size_t *internal_nodes) {
+    *leaves = 0;
+    *internal_nodes = 0;
+    if(tree == NULL) return;
+
+    qt_cache_aggregates(tree);
+    *leaves = tree->nb_leaves;
+    *internal_nodes = tree->nb_nodes - tree->nb_leaves;
+}
+
+void count_distinct_nodes(Quadtree tree, size_t *leaves, size_t *internal_nodes) {
+    NodeStack stack = {0, 0, NULL};
+    NodeMap visited;
+    size_t i;
+
+    nmap_init(&visited);
+    stack_push(&stack, tree);
+    while(stack.size > 0) {
+        Quadtree node = stack.nodes[--stack.size];
+        if(!nmap_put(&visited, node, 0)) continue;
+
+        if(qt_is_leaf(node)) {
+            (*leaves)++;
+            continue;
+        }
+        (*internal_nodes)++;
+
+        for (i = 0; i < QT_MAX_NODE; i++)
+        {
+            stack_push(&stack, node->nodes[i]);
+        }
+    }
+
+    nmap_clear(visited);
+    free(stack.nodes);
 }
 
 /**
  * Free a minimized quadtree. Prevent double free as two branches can have the same leaf.
+ * A tree allocated in an arena is released without being traversed.
  * \param tree the minimized tree to be freed.
  */
 void qt_free_minimized(Quadtree tree) {
-    qt_reset_visited_nodes(tree);
-    
-    TreeLinkedList tree_buffer = NULL;
-    collect_distinct_nodes(tree, &tree_buffer);
-    tll_free_with_value(tree_buffer);
-}
+    if(tree != NULL && tree->in_arena) {
+        qt_free(tree);
+        return;
+    }
 
-void collect_distinct_nodes(Quadtree tree, TreeLinkedList *tree_buffer)
-{
-    if (tree == NULL) return;
+    NodeMap visited;
+    nmap_init(&visited);
+    collect_distinct_nodes(tree, &visited);
 
     size_t i;
-    for (i = 0; i < QT_MAX_NODE; i++)
+    for (i = 0; i < visited.capacity; i++)
     {
-        collect_distinct_nodes(tree->nodes[i], tree_buffer);
+        if(visited.keys[i] != NULL && !visited.keys[i]->in_arena)
+            free(visited.keys[i]);
     }
+    nmap_clear(visited);
+}
+
+void collect_distinct_nodes(Quadtree tree, NodeMap *visited)
+{
+    NodeStack stack = {0, 0, NULL};
+    size_t i;
 
-    if(!tree->visited) {
-        tll_add(tree_buffer, tree);
-        tree->visited = 1;
+    if (tree != NULL)
+        stack_push(&stack, tree);
+    while (stack.size > 0)
+    {
+        Quadtree node = stack.nodes[--stack.size];
+        if (!nmap_put(visited, node, 0)) continue;
+
+        for (i = 0; i < QT_MAX_NODE && node->nodes[i] != NULL; i++)
+        {
+            stack_push(&stack, node->nodes[i]);
+        }
     }
+    free(stack.nodes);
 }
 
 /**
- * Set an identification number on each nodes of a specified quadtree.
- * \param tree the tree to be modified.
+ * Number the distinct nodes of a specified quadtree in depth-first order,
+ * starting from 0 at the root.
+ * \param tree the tree to be numbered.
+ * \param ids the initialized map which will receive the number of each node.
  */
-void qt_set_id(Quadtree tree) {
-    static int id = 0;
-    if(tree == NULL || tree->visited) return;
-    tree->visited = 1;
+void qt_set_id(Quadtree tree, NodeMap *ids) {
+    NodeStack stack = {0, 0, NULL};
+    int i;
 
-    tree->id = id;
-    id++;
+    if(tree != NULL)
+        stack_push(&stack, tree);
+    while(stack.size > 0) {
+        Quadtree node = stack.nodes[--stack.size];
+        if(!nmap_put(ids, node, ids->size)) continue;
 
-    size_t i;
-    for (i = 0; i < QT_MAX_NODE; i++)
-    {
-        qt_set_id(tree->nodes[i]);
+        /* Pushed backward so the first child is numbered first. */
+        for (i = QT_MAX_NODE - 1; i >= 0; i--)
+        {
+            if(node->nodes[i] != NULL)
+                stack_push(&stack, node->nodes[i]);
+        }
     }
-    
+    free(stack.nodes);
 }
 
 /* Reset internal node average color. */
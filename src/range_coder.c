@@ -0,0 +1,204 @@
+/*
+Adaptive binary range coder. The range is split in proportion to the
+probability of a zero bit, and is shifted out by bytes when it gets under
+RC_TOP. A byte of the encoder may still be changed by a carry, so it is kept
+back with the bytes 0xFF following it until the carry is known. The decoder
+reads the first byte of the encoder, always 0, with the code.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/range_coder.h"
+
+/* The range is shifted out when it gets under this value. */
+#define RC_TOP ((uint32_t) 1 << 24)
+
+/* Speed of the adaptation, the probabilities moving by 1/32 of their gap. */
+#define RC_MOVE_BITS 5
+
+/* Number of bytes flushed by the encoder and read by the decoder first. */
+#define RC_INIT_BYTES 5
+
+static void shift_low(RangeEncoder *encoder);
+
+/**
+ * Initialize contexts which have not coded any bit.
+ * \param probs the probabilities of the contexts.
+ * \param nb_probs the number of contexts.
+ */
+void rcoder_init_probs(RcProb *probs, size_t nb_probs)
+{
+    size_t i;
+
+    for (i = 0; i < nb_probs; i++)
+    {
+        probs[i] = RC_PROB_INIT;
+    }
+}
+
+/**
+ * Initialize an encoder writing to the specified bit buffer, which must be
+ * flushed using rcoder_flush.
+ * \param encoder the encoder to be initialized.
+ * \param b_buffer the bit buffer receiving the bytes.
+ */
+void rcoder_encoder_init(RangeEncoder *encoder, BitBuffer *b_buffer)
+{
+    encoder->b_buffer = b_buffer;
+    encoder->low = 0;
+    encoder->range = 0xFFFFFFFF;
+    encoder->cache = 0;
+    encoder->cache_size = 1;
+}
+
+/**
+ * Code a bit in a context, then adapt its probability.
+ * \param encoder the encoder.
+ * \param prob the probability of the context.
+ * \param bit the bit to code.
+ */
+void rcoder_encode(RangeEncoder *encoder, RcProb *prob, int bit)
+{
+    uint32_t bound = (encoder->range >> RC_PROB_BITS) * *prob;
+
+    if (!bit)
+    {
+        encoder->range = bound;
+        *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+    }
+    else
+    {
+        encoder->low += bound;
+        encoder->range -= bound;
+        *prob -= *prob >> RC_MOVE_BITS;
+    }
+
+    while (encoder->range < RC_TOP)
+    {
+        encoder->range <<= 8;
+        shift_low(encoder);
+    }
+}
+
+/**
+ * Code a byte, the most significant bit first, each bit in the context of the
+ * bits before it.
+ * \param encoder the encoder.
+ * \param probs the probabilities of the nodes of the tree of the byte.
+ * \param byte the byte to code.
+ */
+void rcoder_encode_byte(RangeEncoder *encoder, RcProb probs[RC_BYTE_PROBS], int byte)
+{
+    int node = 1, i;
+
+    for (i = 7; i >= 0; i--)
+    {
+        int bit = (byte >> i) & 1;
+        rcoder_encode(encoder, probs + node, bit);
+        node = node << 1 | bit;
+    }
+}
+
+/**
+ * Write the last bytes of an encoder.
+ * \param encoder the encoder to be flushed.
+ */
+void rcoder_flush(RangeEncoder *encoder)
+{
+    int i;
+
+    for (i = 0; i < RC_INIT_BYTES; i++)
+    {
+        shift_low(encoder);
+    }
+}
+
+/* Write the top byte of the low end, unless a carry may still reach it. */
+void shift_low(RangeEncoder *encoder)
+{
+    if ((uint32_t) encoder->low < 0xFF000000 || (encoder->low >> 32) != 0)
+    {
+        int carry = encoder->low >> 32;
+        uint8_t byte = encoder->cache;
+        do
+        {
+            bbuf_add_bits(encoder->b_buffer, (uint8_t) (byte + carry), 8);
+            byte = 0xFF;
+        } while (--encoder->cache_size != 0);
+        encoder->cache = encoder->low >> 24;
+    }
+
+    encoder->cache_size++;
+    encoder->low = (encoder->low & 0x00FFFFFF) << 8;
+}
+
+/**
+ * Initialize a decoder reading from the specified bit buffer, at the first
+ * byte written by an encoder.
+ * \param decoder the decoder to be initialized.
+ * \param b_buffer the bit buffer holding the bytes.
+ */
+void rcoder_decoder_init(RangeDecoder *decoder, BitBuffer *b_buffer)
+{
+    int i;
+
+    decoder->b_buffer = b_buffer;
+    decoder->range = 0xFFFFFFFF;
+    decoder->code = 0;
+    for (i = 0; i < RC_INIT_BYTES; i++)
+    {
+        decoder->code = decoder->code << 8 | bbuf_read_bits(b_buffer, 8);
+    }
+}
+
+/**
+ * Return the bit coded in a context, then adapt its probability as the
+ * encoder did.
+ * \param decoder the decoder.
+ * \param prob the probability of the context.
+ * \return the decoded bit.
+ */
+int rcoder_decode(RangeDecoder *decoder, RcProb *prob)
+{
+    uint32_t bound = (decoder->range >> RC_PROB_BITS) * *prob;
+    int bit;
+
+    if (decoder->code < bound)
+    {
+        decoder->range = bound;
+        *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+        bit = 0;
+    }
+    else
+    {
+        decoder->code -= bound;
+        decoder->range -= bound;
+        *prob -= *prob >> RC_MOVE_BITS;
+        bit = 1;
+    }
+
+    while (decoder->range < RC_TOP)
+    {
+        decoder->range <<= 8;
+        decoder->code = decoder->code << 8 | bbuf_read_bits(decoder->b_buffer, 8);
+    }
+    return bit;
+}
+
+/**
+ * Return a byte coded by rcoder_encode_byte.
+ * \param decoder the decoder.
+ * \param probs the probabilities of the nodes of the tree of the byte.
+ * \return the decoded byte.
+ */
+int rcoder_decode_byte(RangeDecoder *decoder, RcProb probs[RC_BYTE_PROBS])
+{
+    int node = 1;
+
+    while (node < RC_BYTE_PROBS)
+    {
+        node = node << 1 | rcoder_decode(decoder, probs + node);
+    }
+    return node - RC_BYTE_PROBS;
+}
@@ -0,0 +1,283 @@
+/*
+Minimization driven by a target. The distance is doubled from DISTANCE_RATE
+until it crosses the limit of the targets, then the limit is found by
+bisection. The tree of the bitmap is built once, with the distance of each
+subtree to a leaf of its color, and each candidate distance starts from a
+copy of it: the subtrees within the distance of their color are pruned to a
+leaf, since qtc files do not share subtrees, then the copy is minimized. The
+candidates are measured without being saved, and their quality is computed
+from the pixels under each leaf.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "../include/rate.h"
+#include "../include/minimize.h"
+#include "../include/encode.h"
+
+/* Largest distance searched, above the one of black and white. */
+#define RATE_MAX_DISTANCE 512
+
+/* Width of the range of distances under which the search stops. */
+#define RATE_PRECISION 0.1
+
+/* Largest value of a channel. */
+#define CHANNEL_MAX 255
+
+/**
+ * The tree and targets shared by the candidates of a search.
+ */
+typedef struct {
+    Bitmap *bitmap;
+    Quadtree tree;
+    /* Distance of each subtree to a leaf of its color, in pre-order. */
+    double *prune_distances;
+    RateTarget target;
+    const char *filename;
+    /* The size targets are set, so larger distances come closer to them. */
+    int sized;
+} RateSearch;
+
+/**
+ * A minimized tree with its measures.
+ */
+typedef struct {
+    Quadtree tree;
+    RateResult result;
+} RateCandidate;
+
+static void fill_prune_distances(Quadtree tree, double *distances, size_t *position);
+static Quadtree copy_pruned(RateSearch *search, Quadtree tree, size_t *position, double distance, NodeArena *arena);
+static RateCandidate evaluate(RateSearch *search, double distance);
+static int sizes_met(RateSearch *search, RateResult *result);
+static int on_target(RateSearch *search, RateResult *result);
+static void keep_best(RateSearch *search, RateCandidate *best, RateCandidate candidate);
+static double squared_error(Quadtree tree, Bitmap *bitmap, Area area);
+
+/**
+ * Create a minimized quadtree from a specified bitmap, searching the
+ * distance which meets the targets. When they cannot be met, the tree of
+ * the distance coming the closest is returned. The tree must be freed using
+ * qt_free_minimized.
+ * \param bitmap the bitmap from which to construct the quadtree.
+ * \param target the targets of the minimization.
+ * \param filename the file the tree is to be saved to, its extension giving
+ * the format measured by the size target. It can be NULL without size target.
+ * \param result the pointer which will receive the measures of the tree.
+ * \return the minimized quadtree.
+ */
+Quadtree rate_minimize(Bitmap *bitmap, RateTarget target, const char *filename, RateResult *result)
+{
+    RateSearch search;
+    RateCandidate best, candidate;
+    double low = 0, high = -1, distance = DISTANCE_RATE;
+    size_t position = 0;
+
+    search.bitmap = bitmap;
+    search.target = target;
+    search.filename = filename;
+    search.sized = target.max_bytes != 0 || target.max_nodes != 0;
+    search.tree = qt_create_quadtree_bottom_up(bitmap, 0);
+    search.prune_distances = malloc(qt_count_node(search.tree) * sizeof(double));
+    if (search.prune_distances == NULL)
+    {
+        printf("Error malloc RateSearch\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_prune_distances(search.tree, search.prune_distances, &position);
+
+    best.tree = NULL;
+
+    /* The targets are crossed where the size targets become met, or where
+    the quality target stops being met. */
+    while (high < 0 && low < RATE_MAX_DISTANCE)
+    {
+        candidate = evaluate(&search, distance);
+        if (on_target(&search, &candidate.result) == search.sized)
+            high = distance;
+        else
+            low = distance;
+        keep_best(&search, &best, candidate);
+
+        distance = distance * 2 < RATE_MAX_DISTANCE ? distance * 2 : RATE_MAX_DISTANCE;
+    }
+
+    while (high >= 0 && high - low > RATE_PRECISION)
+    {
+        distance = (low + high) / 2;
+        candidate = evaluate(&search, distance);
+        if (on_target(&search, &candidate.result) == search.sized)
+            high = distance;
+        else
+            low = distance;
+        keep_best(&search, &best, candidate);
+    }
+
+    /* Without loss, the quality target is always met. */
+    if (!on_target(&search, &best.result) && !search.sized)
+        keep_best(&search, &best, evaluate(&search, 0));
+
+    free(search.prune_distances);
+    qt_free(search.tree);
+
+    *result = best.result;
+    return best.tree;
+}
+
+/* Fill the distances of the subtrees to their color, in the order in which
+copy_pruned visits them. */
+void fill_prune_distances(Quadtree tree, double *distances, size_t *position)
+{
+    Node leaf;
+    size_t i;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        leaf.nodes[i] = NULL;
+    }
+    leaf.color = tree->color;
+    distances[(*position)++] = qt_distance(tree, &leaf);
+
+    if (qt_is_leaf(tree)) return;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        fill_prune_distances(tree->nodes[i], distances, position);
+    }
+}
+
+/* Copy a subtree of the tree of the search, the subtrees within the distance
+of their color becoming leaves. The position follows the pre-order of the
+tree, which holds no shared nodes. */
+Quadtree copy_pruned(RateSearch *search, Quadtree tree, size_t *position, double distance, NodeArena *arena)
+{
+    Quadtree copy = qt_create_arena_node(arena, tree->color);
+    size_t i;
+
+    if (qt_is_leaf(tree) || search->prune_distances[*position] <= distance)
+    {
+        *position += tree->nb_nodes;
+        qt_cache_node(copy);
+        return copy;
+    }
+
+    (*position)++;
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        copy->nodes[i] = copy_pruned(search, tree->nodes[i], position, distance, arena);
+    }
+
+    qt_cache_node(copy);
+    return copy;
+}
+
+/* Build and measure the minimized tree of a distance. */
+RateCandidate evaluate(RateSearch *search, double distance)
+{
+    RateCandidate candidate;
+    NodeArena *arena = arena_create();
+    size_t position = 0, leaves, internal_nodes;
+
+    candidate.tree = copy_pruned(search, search->tree, &position, distance, arena);
+    arena->root = candidate.tree;
+    minimize_loss(candidate.tree, distance);
+
+    candidate.result.distance = distance;
+    qt_get_infos(candidate.tree, &leaves, &internal_nodes);
+    candidate.result.nb_nodes = leaves + internal_nodes;
+    candidate.result.nb_bytes = search->filename == NULL ? 0 :
+        enc_size(candidate.tree, search->bitmap->width, search->bitmap->height, search->filename);
+    candidate.result.psnr = rate_psnr(candidate.tree, search->bitmap);
+    candidate.result.met = sizes_met(search, &candidate.result) &&
+        (search->target.min_psnr <= 0 || candidate.result.psnr >= search->target.min_psnr);
+
+    return candidate;
+}
+
+int sizes_met(RateSearch *search, RateResult *result)
+{
+    return (search->target.max_bytes == 0 || result->nb_bytes <= search->target.max_bytes) &&
+        (search->target.max_nodes == 0 || result->nb_nodes <= search->target.max_nodes);
+}
+
+/* The size targets are searched first, the quality target is only searched
+alone. */
+int on_target(RateSearch *search, RateResult *result)
+{
+    return search->sized ? sizes_met(search, result) : result->met;
+}
+
+/* Keep the best of two candidates and free the other one. On target, the
+best one has the smallest distance within the size targets, the largest one
+within the quality target. Off target, the one coming the closest. */
+void keep_best(RateSearch *search, RateCandidate *best, RateCandidate candidate)
+{
+    int candidate_on = on_target(search, &candidate.result);
+    int better;
+
+    if (best->tree == NULL)
+        better = 1;
+    else if (candidate_on != on_target(search, &best->result))
+        better = candidate_on;
+    else
+        better = (candidate.result.distance < best->result.distance) == (search->sized == candidate_on);
+
+    if (better)
+    {
+        qt_free_minimized(best->tree);
+        *best = candidate;
+    }
+    else
+        qt_free_minimized(candidate.tree);
+}
+
+/**
+ * Return the peak signal-to-noise ratio of a quadtree against a bitmap over
+ * the red, green and blue channels. Each pixel is read once, under the leaf
+ * covering it.
+ * \param tree the quadtree covering the bitmap.
+ * \param bitmap the bitmap of the tree.
+ * \return the ratio in decibels, HUGE_VAL if the tree holds the bitmap
+ * without loss.
+ */
+double rate_psnr(Quadtree tree, Bitmap *bitmap)
+{
+    double nb_values = (double) bitmap->width * bitmap->height * 3;
+    double error = squared_error(tree, bitmap, (Area) {0, 0, bitmap->width, bitmap->height});
+
+    if (nb_values <= 0 || error <= 0)
+        return HUGE_VAL;
+    return 10 * log10(CHANNEL_MAX * CHANNEL_MAX / (error / nb_values));
+}
+
+/* Sum the squared differences between each pixel and the leaf covering it. */
+double squared_error(Quadtree tree, Bitmap *bitmap, Area area)
+{
+    double error = 0;
+    int x, y;
+    size_t i;
+
+    if (!qt_is_leaf(tree))
+    {
+        for (i = 0; i < QT_MAX_NODE; i++)
+        {
+            error += squared_error(tree->nodes[i], bitmap, get_sub_area(area, i));
+        }
+        return error;
+    }
+
+    int r = red(tree->color), g = green(tree->color), b = blue(tree->color);
+    uint64_t leaf_error = 0;
+    for (y = area.y; y < area.y + area.height; y++)
+    {
+        for (x = area.x; x < area.x + area.width; x++)
+        {
+            Color color = BITMAP_PIXEL(bitmap, x, y);
+            int dr = red(color) - r, dg = green(color) - g, db = blue(color) - b;
+            leaf_error += dr * dr + dg * dg + db * db;
+        }
+    }
+    return leaf_error;
+}
@@ -0,0 +1,358 @@
+/*
+Index of subtrees by mean color. The signature of a subtree holds its mean
+color and the mean colors of the 16 squares of a 4x4 grid over its area, a
+leaf having its color in all of them. The means weight each quadrant equally,
+as qt_distance does, so the distance of the mean colors of two subtrees, and
+the average distance of their squares, are never greater than their
+qt_distance. The cells close to a query are listed from the grid and their
+subtrees are only compared with qt_distance_bounded when both bounds allow
+it.
+
+Subtrees are only matched with subtrees of the same height. Replacing a
+subtree then keeps the height of its parents, and the cells hold fewer
+candidates.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "../include/subtree_index.h"
+
+/* Number of channels of the mean colors in the grid, the alpha channel being
+left out. */
+#define KEY_SIZE 3
+
+/* Tolerance on the bounds, for rounding errors. */
+#define MEAN_EPSILON 1e-3
+
+/* Largest error on the distance of two squares of signatures, each channel
+being rounded by at most 0.5 in both. */
+#define SQUARE_ROUNDING 2
+
+/**
+ * A subtree searched in the index.
+ */
+typedef struct {
+    Quadtree tree;
+    int height;
+    size_t signature;
+} IndexQuery;
+
+static size_t signature_of(SubtreeIndex *index, Quadtree tree);
+static size_t new_signature(SubtreeIndex *index, Quadtree tree);
+static void sign_children(SubtreeIndex *index, Quadtree tree, size_t signature);
+static double squared_color_gap(const float *a, const float *b);
+static double square_gap(const uint8_t *a, const uint8_t *b);
+static uint32_t cell_key(int coordinates[KEY_SIZE], int height);
+static double cell_gap(SubtreeIndex *index, int coordinates[KEY_SIZE], const float *mean);
+static Quadtree find_in_cell(SubtreeIndex *index, uint32_t key, IndexQuery *query);
+static int is_close(SubtreeIndex *index, Quadtree candidate, size_t signature, IndexQuery *query);
+
+/**
+ * Initialize an empty index for a distance. It must be released using
+ * sindex_clear.
+ * \param index the index to be initialized.
+ * \param expected_trees the number of trees expected, such as the number of
+ * nodes of the tree to be minimized.
+ * \param distance the distance under which two subtrees are found.
+ */
+void sindex_init(SubtreeIndex *index, size_t expected_trees, double distance)
+{
+    index->distance = distance;
+    index->cell_size = distance < 1 ? 1 : distance;
+    ttable_init(&index->cells, expected_trees);
+    nmap_init(&index->signature_ids);
+
+    index->nb_signatures = 0;
+    index->signatures_capacity = expected_trees > 0 ? expected_trees : 1;
+    index->signatures = malloc(index->signatures_capacity * sizeof(SubtreeSignature));
+    index->entry_signatures = malloc(index->signatures_capacity * sizeof(size_t));
+    if (index->signatures == NULL || index->entry_signatures == NULL)
+    {
+        printf("Error malloc SubtreeIndex\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Release the specified index. The trees are not freed.
+ * \param index the index to be cleared.
+ */
+void sindex_clear(SubtreeIndex index)
+{
+    ttable_clear(index.cells);
+    nmap_clear(index.signature_ids);
+    free(index.signatures);
+    free(index.entry_signatures);
+}
+
+/**
+ * Add a tree to the specified index. Its children must not change anymore,
+ * the signature being computed from theirs.
+ * \param index the index to be modified.
+ * \param tree the tree to be added.
+ */
+void sindex_add(SubtreeIndex *index, Quadtree tree)
+{
+    int coordinates[KEY_SIZE];
+    size_t signature, i;
+
+    signature = signature_of(index, tree);
+    if (!qt_is_leaf(tree))
+        sign_children(index, tree, signature);
+
+    for (i = 0; i < KEY_SIZE; i++)
+    {
+        coordinates[i] = index->signatures[signature].mean[i] / index->cell_size;
+    }
+
+    /* A tree is added at most once, so there are no more entries than
+    signatures. */
+    index->entry_signatures[index->cells.nb_entries] = signature;
+    ttable_add(&index->cells, cell_key(coordinates, qt_height(tree)), tree);
+}
+
+/**
+ * Return a tree of the index within the distance of a tree. The cells are
+ * searched in order, then the most recent trees first.
+ * \param index the index to search from.
+ * \param tree the other quadtree to compare with.
+ * \return the found quadtree, or NULL if there is none.
+ */
+Quadtree sindex_find(SubtreeIndex *index, Quadtree tree)
+{
+    int low[KEY_SIZE], high[KEY_SIZE], coordinates[KEY_SIZE];
+    int max_coordinate = 255 / index->cell_size;
+    IndexQuery query;
+    size_t i;
+
+    if (tree == NULL) return NULL;
+
+    query.tree = tree;
+    query.height = qt_height(tree);
+    query.signature = signature_of(index, tree);
+    const float *mean = index->signatures[query.signature].mean;
+
+    for (i = 0; i < KEY_SIZE; i++)
+    {
+        low[i] = floor((mean[i] - index->distance) / index->cell_size);
+        high[i] = floor((mean[i] + index->distance) / index->cell_size);
+        if (low[i] < 0) low[i] = 0;
+        if (high[i] > max_coordinate) high[i] = max_coordinate;
+        coordinates[i] = low[i];
+    }
+
+    /* The cells of the box around the mean color are listed like the digits
+    of a number, skipping the ones too far from it. */
+    while (1)
+    {
+        if (cell_gap(index, coordinates, mean) <= index->distance + MEAN_EPSILON)
+        {
+            Quadtree found = find_in_cell(index, cell_key(coordinates, query.height), &query);
+            if (found != NULL)
+                return found;
+        }
+
+        for (i = 0; i < KEY_SIZE && coordinates[i] == high[i]; i++)
+        {
+            coordinates[i] = low[i];
+        }
+        if (i == KEY_SIZE) break;
+        coordinates[i]++;
+    }
+
+    return NULL;
+}
+
+/* Return the signature of a tree, computing the ones of its subtrees once. */
+size_t signature_of(SubtreeIndex *index, Quadtree tree)
+{
+    size_t signature, i, j;
+
+    if (nmap_get(&index->signature_ids, tree, &signature))
+        return signature;
+
+    if (qt_is_leaf(tree))
+    {
+        signature = new_signature(index, tree);
+        SubtreeSignature *leaf = index->signatures + signature;
+        leaf->mean[0] = red(tree->color);
+        leaf->mean[1] = green(tree->color);
+        leaf->mean[2] = blue(tree->color);
+        leaf->mean[3] = alpha(tree->color);
+        for (i = 0; i < SIGNATURE_SQUARES; i++)
+        {
+            for (j = 0; j < NB_CHANNELS; j++)
+            {
+                leaf->squares[i][j] = leaf->mean[j];
+            }
+        }
+        return signature;
+    }
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        signature_of(index, tree->nodes[i]);
+    }
+    signature = new_signature(index, tree);
+    sign_children(index, tree, signature);
+    return signature;
+}
+
+size_t new_signature(SubtreeIndex *index, Quadtree tree)
+{
+    if (index->nb_signatures == index->signatures_capacity)
+    {
+        index->signatures_capacity *= 2;
+        index->signatures = realloc(index->signatures, index->signatures_capacity * sizeof(SubtreeSignature));
+        index->entry_signatures = realloc(index->entry_signatures, index->signatures_capacity * sizeof(size_t));
+        if (index->signatures == NULL || index->entry_signatures == NULL)
+        {
+            printf("Error malloc SubtreeIndex\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    nmap_put(&index->signature_ids, tree, index->nb_signatures);
+    return index->nb_signatures++;
+}
+
+/* The children of a node may have been replaced since its signature was
+computed, so it is computed again from theirs. The squares are the mean
+colors of the grandchildren, a leaf child standing for its 4 quadrants. */
+void sign_children(SubtreeIndex *index, Quadtree tree, size_t signature)
+{
+    size_t children[QT_MAX_NODE], grandchildren[SIGNATURE_SQUARES];
+    size_t i, j, k;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        Quadtree child = tree->nodes[i];
+        children[i] = signature_of(index, child);
+        for (j = 0; j < QT_MAX_NODE; j++)
+        {
+            grandchildren[i * QT_MAX_NODE + j] = qt_is_leaf(child) ?
+                children[i] : signature_of(index, child->nodes[j]);
+        }
+    }
+
+    SubtreeSignature *node = index->signatures + signature;
+    for (k = 0; k < NB_CHANNELS; k++)
+    {
+        float sum = 0;
+        for (i = 0; i < QT_MAX_NODE; i++)
+        {
+            sum += index->signatures[children[i]].mean[k];
+        }
+        node->mean[k] = sum / QT_MAX_NODE;
+
+        for (i = 0; i < SIGNATURE_SQUARES; i++)
+        {
+            node->squares[i][k] = index->signatures[grandchildren[i]].mean[k] + 0.5f;
+        }
+    }
+}
+
+/* Return the squared distance of two colors with float channels. */
+double squared_color_gap(const float *a, const float *b)
+{
+    double sum = 0;
+    size_t i;
+
+    for (i = 0; i < NB_CHANNELS; i++)
+    {
+        double difference = a[i] - b[i];
+        sum += difference * difference;
+    }
+    return sum;
+}
+
+/* Return the distance of two squares of signatures. */
+double square_gap(const uint8_t *a, const uint8_t *b)
+{
+    int sum = 0;
+    size_t i;
+
+    for (i = 0; i < NB_CHANNELS; i++)
+    {
+        int difference = a[i] - b[i];
+        sum += difference * difference;
+    }
+    return sqrt(sum);
+}
+
+/* Return the key of a cell in the table for the trees of a height. Cells may
+share a key, their trees being checked anyway. */
+uint32_t cell_key(int coordinates[KEY_SIZE], int height)
+{
+    uint32_t key = 0;
+    size_t i;
+
+    for (i = 0; i < KEY_SIZE; i++)
+    {
+        key = (key ^ (uint32_t) coordinates[i]) * 0x01000193u;
+    }
+    return key ^ (uint32_t) height * 0x9e3779b1u;
+}
+
+/* Return the distance from a mean color to the closest color of a cell. */
+double cell_gap(SubtreeIndex *index, int coordinates[KEY_SIZE], const float *mean)
+{
+    double sum = 0;
+    size_t i;
+
+    for (i = 0; i < KEY_SIZE; i++)
+    {
+        double start = coordinates[i] * index->cell_size;
+        double difference = 0;
+        if (mean[i] < start)
+            difference = start - mean[i];
+        else if (mean[i] > start + index->cell_size)
+            difference = mean[i] - start - index->cell_size;
+        sum += difference * difference;
+    }
+    return sqrt(sum);
+}
+
+/* Walk the trees of a cell, their signatures being found from their entries
+without looking the trees up. */
+Quadtree find_in_cell(SubtreeIndex *index, uint32_t key, IndexQuery *query)
+{
+    long entry = ttable_first(&index->cells, key);
+    while (entry != -1)
+    {
+        Quadtree candidate = index->cells.entries[entry].tree;
+        if (is_close(index, candidate, index->entry_signatures[entry], query))
+            return candidate;
+        entry = index->cells.entries[entry].next;
+    }
+
+    return NULL;
+}
+
+/* Return 1 if a tree of the index is within the distance of the query. The
+mean colors, then the squares, are compared first, as their distances are
+lower bounds. The cells hold trees of other heights when keys collide. */
+int is_close(SubtreeIndex *index, Quadtree candidate, size_t signature, IndexQuery *query)
+{
+    SubtreeSignature *a = index->signatures + signature;
+    SubtreeSignature *b = index->signatures + query->signature;
+    double mean_limit = index->distance + MEAN_EPSILON;
+    double limit = (index->distance + MEAN_EPSILON + SQUARE_ROUNDING) * SIGNATURE_SQUARES;
+    double sum = 0;
+    size_t i;
+
+    if (squared_color_gap(a->mean, b->mean) > mean_limit * mean_limit)
+        return 0;
+
+    for (i = 0; i < SIGNATURE_SQUARES; i++)
+    {
+        sum += square_gap(a->squares[i], b->squares[i]);
+        if (sum > limit)
+            return 0;
+    }
+
+    return qt_height(candidate) == query->height &&
+        qt_distance_bounded(candidate, query->tree, index->distance) <= index->distance;
+}
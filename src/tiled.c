@@ -0,0 +1,114 @@
+/*
+Out-of-core quadtree construction. The image is split like the quadtree
+until the areas are small enough to be read as tiles. The subtree of each
+tile is built bottom-up, then the subtrees are merged under the top levels
+exactly as the bottom-up construction merges its children.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/tiled.h"
+#include "../include/ingest.h"
+
+/**
+ * State of a tiled construction.
+ */
+typedef struct {
+    ImageStream stream;
+    NodeArena *arena;
+    long tile_pixels;
+    long tolerance;
+    int failed;
+} TiledBuild;
+
+static Quadtree build_tiles(TiledBuild *build, Area area, ChannelSums *sums);
+
+/**
+ * Create a quadtree from a netpbm file too large to be loaded at once. The
+ * tree is the same as qt_create_quadtree_bottom_up on the whole image.
+ * \param filename the ppm, pgm or pam file of the image.
+ * \param tile_size the side of the largest tile read at once, in pixels.
+ * \param tolerance the maximum error value of a merged area, 0 for lossless.
+ * \param width the pointer which will receive the width of the image.
+ * \param height the pointer which will receive the height of the image.
+ * \return the quadtree of the image, or NULL if the file couldn't be read.
+ */
+Quadtree tiled_create_quadtree(const char *filename, int tile_size, long tolerance,
+    int *width, int *height)
+{
+    TiledBuild build;
+    ChannelSums sums;
+    Quadtree tree;
+
+    if (!ingest_open(filename, &build.stream))
+        return NULL;
+
+    if (tile_size <= 0)
+        tile_size = TILED_DEFAULT_TILE;
+
+    build.arena = arena_create();
+    build.tile_pixels = (long) tile_size * tile_size;
+    build.tolerance = tolerance;
+    build.failed = 0;
+
+    Area area = {0, 0, build.stream.width, build.stream.height};
+    tree = build_tiles(&build, area, &sums);
+    ingest_close(&build.stream);
+
+    if (build.failed)
+    {
+        printf("Couldn't read the pixels of %s\n", filename);
+        arena_release(build.arena);
+        return NULL;
+    }
+
+    if (tree == NULL)
+    {
+        tree = qt_create_arena_node(build.arena, sums_average_color(&sums, (long) area.width * area.height));
+        qt_cache_node(tree);
+    }
+
+    *width = area.width;
+    *height = area.height;
+    build.arena->root = tree;
+    return tree;
+}
+
+/* Return NULL when the area collapses to a single leaf, like the bottom-up
+construction. Tiles are read in the depth-first order of the tree. */
+Quadtree build_tiles(TiledBuild *build, Area area, ChannelSums *sums)
+{
+    if ((long) area.width * area.height <= build->tile_pixels)
+    {
+        Bitmap tile;
+        Quadtree tree = NULL;
+        size_t k;
+
+        if (!build->failed && ingest_read_area(&build->stream, area, &tile))
+        {
+            tree = qt_bottom_up_subtree(&tile, build->tolerance, sums, build->arena);
+            bitmap_clear(tile);
+            return tree;
+        }
+
+        build->failed = 1;
+        for (k = 0; k < 4; k++)
+        {
+            sums->sum[k] = 0;
+            sums->square[k] = 0;
+        }
+        return NULL;
+    }
+
+    Quadtree children[QT_MAX_NODE];
+    ChannelSums children_sums[QT_MAX_NODE];
+    size_t i;
+
+    for (i = 0; i < QT_MAX_NODE; i++)
+    {
+        children[i] = build_tiles(build, get_sub_area(area, i), &children_sums[i]);
+    }
+
+    return qt_merge_subtrees(children, children_sums, area, build->tolerance, sums, build->arena);
+}
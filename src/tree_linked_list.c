@@ -5,7 +5,7 @@
 #include "../include/tree_linked_list.h"
 
 TreeLinkedList create_node(Quadtree tree) {
-    TreeLinkedList node = malloc(sizeof(Node));
+    TreeLinkedList node = malloc(sizeof(struct tll_node));
     if (node == NULL)
     {
         printf("Error malloc LinkedList\n");
@@ -0,0 +1,170 @@
+/*
+Hash table of quadtrees grouped by key. Keys are stored with linear probing
+in a table kept at most half full, and the trees of all keys share one
+array of entries, so adding a tree is not a separate allocation.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/tree_table.h"
+
+/* Smallest number of slots, a power of 2. */
+#define TTABLE_MIN_SLOTS 16
+
+static void allocate_slots(TreeTable *table, size_t nb_slots);
+static size_t find_slot(TreeTable *table, uint32_t key);
+static void grow_slots(TreeTable *table);
+
+/**
+ * Initialize an empty table sized for a number of trees. It must be released
+ * using ttable_clear.
+ * \param table the table to be initialized.
+ * \param expected_trees the number of trees expected, such as the number of
+ * nodes of the tree to be minimized.
+ */
+void ttable_init(TreeTable *table, size_t expected_trees)
+{
+    size_t nb_slots = TTABLE_MIN_SLOTS;
+    while (nb_slots < 2 * expected_trees)
+        nb_slots *= 2;
+
+    allocate_slots(table, nb_slots);
+    table->nb_keys = 0;
+
+    table->nb_entries = 0;
+    table->entries_capacity = expected_trees > 0 ? expected_trees : 1;
+    table->entries = malloc(table->entries_capacity * sizeof(TreeEntry));
+    if (table->entries == NULL)
+    {
+        printf("Error malloc TreeTable\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void allocate_slots(TreeTable *table, size_t nb_slots)
+{
+    size_t i;
+
+    table->nb_slots = nb_slots;
+    table->slot_bits = 0;
+    while (((size_t) 1 << table->slot_bits) < nb_slots)
+        table->slot_bits++;
+    table->slots = malloc(nb_slots * sizeof(TreeSlot));
+    if (table->slots == NULL)
+    {
+        printf("Error malloc TreeTable\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nb_slots; i++)
+    {
+        table->slots[i].head = -1;
+    }
+}
+
+/**
+ * Release the specified table. The trees are not freed.
+ * \param table the table to be cleared.
+ */
+void ttable_clear(TreeTable table)
+{
+    free(table.slots);
+    free(table.entries);
+}
+
+/**
+ * Add a tree to the specified table.
+ * \param table the table to be modified.
+ * \param key the key of the tree.
+ * \param tree the tree to be added.
+ */
+void ttable_add(TreeTable *table, uint32_t key, Quadtree tree)
+{
+    if (table->nb_entries == table->entries_capacity)
+    {
+        table->entries_capacity *= 2;
+        table->entries = realloc(table->entries, table->entries_capacity * sizeof(TreeEntry));
+        if (table->entries == NULL)
+        {
+            printf("Error malloc TreeTable\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t slot = find_slot(table, key);
+    if (table->slots[slot].head == -1)
+    {
+        table->slots[slot].key = key;
+        table->nb_keys++;
+    }
+
+    table->entries[table->nb_entries].tree = tree;
+    table->entries[table->nb_entries].next = table->slots[slot].head;
+    table->slots[slot].head = table->nb_entries;
+    table->nb_entries++;
+
+    if (2 * table->nb_keys > table->nb_slots)
+        grow_slots(table);
+}
+
+/**
+ * Return the most recently added entry of a key accepted by a function.
+ * \param table the table to search from.
+ * \param key the key of the trees to be tested.
+ * \param match the function returning 1 for the tree to be found.
+ * \param data the pointer passed to each call.
+ * \return the index of the entry in the table, or -1 if there is none.
+ */
+long ttable_find(TreeTable *table, uint32_t key, int (*match)(Quadtree candidate, void *data), void *data)
+{
+    long entry = table->slots[find_slot(table, key)].head;
+    while (entry != -1)
+    {
+        if (match(table->entries[entry].tree, data))
+            return entry;
+        entry = table->entries[entry].next;
+    }
+
+    return -1;
+}
+
+/**
+ * Return the most recently added entry of a key. The other ones are chained
+ * from it by their next field.
+ * \param table the table to search from.
+ * \param key the key of the trees.
+ * \return the index of the entry in the table, or -1 if there is none.
+ */
+long ttable_first(TreeTable *table, uint32_t key)
+{
+    return table->slots[find_slot(table, key)].head;
+}
+
+/* Return the slot of a key, or the empty slot where it belongs. The slot
+is taken from the high bits of a 64 bits product, so every slot of a large
+table can be reached. */
+size_t find_slot(TreeTable *table, uint32_t key)
+{
+    size_t mask = table->nb_slots - 1;
+    size_t slot = (size_t) (((uint64_t) key * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - table->slot_bits));
+
+    while (table->slots[slot].head != -1 && table->slots[slot].key != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void grow_slots(TreeTable *table)
+{
+    TreeSlot *old_slots = table->slots;
+    size_t old_nb_slots = table->nb_slots;
+    size_t i;
+
+    allocate_slots(table, 2 * old_nb_slots);
+    for (i = 0; i < old_nb_slots; i++)
+    {
+        if (old_slots[i].head != -1)
+            table->slots[find_slot(table, old_slots[i].key)] = old_slots[i];
+    }
+    free(old_slots);
+}